@@ -0,0 +1,227 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include "fea_utils/platform.hpp"
+#include "fea_utils/unicode.hpp"
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(FEA_SSE2)
+#include <emmintrin.h>
+#endif
+#if defined(FEA_SSSE3)
+#include <tmmintrin.h>
+#endif
+
+namespace fea {
+// A set of byte values, compiled once for fast scanning.
+// Membership is a 256 bit bitmap. Blocks of 16 bytes are tested at once
+// with nibble lookup tables when SSSE3 is enabled. Without it, sets of up
+// to 8 bytes are compared with SSE2, and the others use the bitmap.
+struct char_set {
+	constexpr char_set() = default;
+	constexpr char_set(std::string_view chars) {
+		for (char c : chars) {
+			insert(c);
+		}
+	}
+
+	constexpr void insert(char c) {
+		const uint32_t u = unit_value(c);
+		if (contains(c)) {
+			return;
+		}
+
+		_bits[u / 64] |= uint64_t(1) << (u % 64);
+
+		// Rows are indexed by the low nibble. Each bit is a high nibble,
+		// 0 to 7 in the first table, 8 to 15 in the second.
+		const uint32_t hi = u >> 4;
+		if (hi < 8) {
+			_rows_0_7[u & 0xF] |= uint8_t(1u << hi);
+		} else {
+			_rows_8_15[u & 0xF] |= uint8_t(1u << (hi - 8));
+		}
+
+		if (_size < max_compared) {
+			_members[_size] = c;
+		}
+		++_size;
+	}
+
+	[[nodiscard]] constexpr bool contains(char c) const {
+		const uint32_t u = unit_value(c);
+		return (_bits[u / 64] >> (u % 64)) & 1;
+	}
+
+	// Number of bytes in the set.
+	[[nodiscard]] constexpr size_t size() const {
+		return _size;
+	}
+
+	[[nodiscard]] constexpr bool empty() const {
+		return _size == 0;
+	}
+
+	// Returns the position of the first byte in the set, or npos.
+	[[nodiscard]] size_t find_first_of(
+			std::string_view str, size_t pos = 0) const {
+		return find<true>(str, pos);
+	}
+
+	// Returns the position of the first byte not in the set, or npos.
+	[[nodiscard]] size_t find_first_not_of(
+			std::string_view str, size_t pos = 0) const {
+		return find<false>(str, pos);
+	}
+
+	// Returns the position of the last byte not in the set, or npos.
+	[[nodiscard]] size_t find_last_not_of(std::string_view str) const {
+		for (size_t i = str.size(); i > 0; --i) {
+			if (!contains(str[i - 1])) {
+				return i - 1;
+			}
+		}
+		return std::string_view::npos;
+	}
+
+	// Counts the bytes in the set.
+	[[nodiscard]] size_t count(std::string_view str) const {
+		size_t ret = 0;
+		size_t i = 0;
+
+#if defined(FEA_SSE2)
+		if (vectorized()) {
+			for (; i + 16 <= str.size(); i += 16) {
+				ret += bit_count(match_mask(str.data() + i));
+			}
+		}
+#endif
+
+		for (; i < str.size(); ++i) {
+			ret += contains(str[i]);
+		}
+		return ret;
+	}
+
+private:
+	static constexpr size_t max_compared = 8;
+
+	template <bool InSet>
+	size_t find(std::string_view str, size_t pos) const {
+		size_t i = pos;
+
+#if defined(FEA_SSE2)
+		if (vectorized()) {
+			for (; i + 16 <= str.size(); i += 16) {
+				uint32_t mask = match_mask(str.data() + i);
+				if constexpr (!InSet) {
+					mask ^= 0xFFFF;
+				}
+				if (mask != 0) {
+					// Index of the lowest set bit.
+					return i + bit_count((mask & (0 - mask)) - 1);
+				}
+			}
+		}
+#endif
+
+		for (; i < str.size(); ++i) {
+			if (contains(str[i]) == InSet) {
+				return i;
+			}
+		}
+		return std::string_view::npos;
+	}
+
+#if defined(FEA_SSE2)
+	[[nodiscard]] bool vectorized() const {
+#if defined(FEA_SSSE3)
+		return true;
+#else
+		return _size <= max_compared;
+#endif
+	}
+
+	// Returns a 16 bit mask of the bytes of the block in the set.
+	uint32_t match_mask(const char* block) const {
+		const __m128i v
+				= _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+		const __m128i zero = _mm_setzero_si128();
+
+#if defined(FEA_SSSE3)
+		// Shuffles return 0 for indices with the high bit set, so each table
+		// only answers for its half of the bytes.
+		const __m128i rows_0_7 = _mm_shuffle_epi8(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(_rows_0_7)),
+				v);
+		const __m128i rows_8_15 = _mm_shuffle_epi8(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(_rows_8_15)),
+				_mm_xor_si128(v, _mm_set1_epi8(char(0x80))));
+
+		// The bit of each byte's high nibble, in its row.
+		const __m128i hi
+				= _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+		const __m128i bits = _mm_shuffle_epi8(
+				_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, char(128), 1, 2, 4, 8,
+						16, 32, 64, char(128)),
+				hi);
+
+		const __m128i found = _mm_and_si128(
+				_mm_or_si128(rows_0_7, rows_8_15), bits);
+		return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(found, zero)))
+				^ 0xFFFF;
+#else
+		__m128i found = zero;
+		for (size_t i = 0; i < _size; ++i) {
+			found = _mm_or_si128(
+					found, _mm_cmpeq_epi8(v, _mm_set1_epi8(_members[i])));
+		}
+		return uint32_t(_mm_movemask_epi8(found));
+#endif
+	}
+#endif
+
+	uint64_t _bits[4]{};
+	uint8_t _rows_0_7[16]{};
+	uint8_t _rows_8_15[16]{};
+	// The first bytes inserted, for the compare path.
+	char _members[max_compared]{};
+	size_t _size{ 0 };
+};
+
+// Whitespace, as std::isspace in the "C" locale.
+inline constexpr char_set whitespace_set{ " \t\n\v\f\r" };
+} // namespace fea
@@ -0,0 +1,384 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include "fea_utils/unicode.hpp"
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+
+// Single-byte legacy codepages, as codecs for the unicode kernels.
+// A codepage is described by the code points of its upper 128 bytes, the
+// lower half is ascii. The reverse tables are generated at compile time.
+namespace fea {
+// Code points of bytes 0x80 to 0xFF. 0 marks undefined bytes.
+using codepage_table = std::array<char16_t, 128>;
+
+// Maps code points back to bytes. Code points are split in 256 wide pages,
+// only the pages the codepage uses are stored. Page 0 is empty, unused pages
+// point to it. Pages are stored flat, page p starts at p * 256.
+template <size_t PageCount>
+struct codepage_reverse_table {
+	uint8_t page_of[256]{};
+	std::array<uint8_t, (PageCount + 1) * 256> pages{};
+
+	// Returns the byte storing the code point, 0 if there is none.
+	[[nodiscard]] constexpr uint8_t find(char32_t cp) const {
+		if (cp > 0xFFFF) {
+			return 0;
+		}
+		return pages[size_t(page_of[cp >> 8]) * 256 + (cp & 0xFF)];
+	}
+};
+
+// The number of 256 wide code point pages the table uses.
+[[nodiscard]] constexpr size_t codepage_page_count(
+		const codepage_table& table) {
+	bool used[256]{};
+	size_t ret = 0;
+	for (char16_t cp : table) {
+		if (cp != 0 && !used[cp >> 8]) {
+			used[cp >> 8] = true;
+			++ret;
+		}
+	}
+	return ret;
+}
+
+template <size_t PageCount>
+[[nodiscard]] constexpr codepage_reverse_table<PageCount>
+make_codepage_reverse_table(const codepage_table& table) {
+	codepage_reverse_table<PageCount> ret{};
+	size_t next_page = 1;
+	for (size_t i = 0; i < table.size(); ++i) {
+		const char16_t cp = table[i];
+		if (cp == 0) {
+			continue;
+		}
+
+		if (ret.page_of[cp >> 8] == 0) {
+			ret.page_of[cp >> 8] = uint8_t(next_page++);
+		}
+		ret.pages[size_t(ret.page_of[cp >> 8]) * 256 + (cp & 0xFF)]
+				= uint8_t(0x80 + i);
+	}
+	return ret;
+}
+
+// A single-byte codepage. Traits provide its codepage_table, as a static
+// constexpr member named table.
+template <class Traits>
+struct single_byte_codec {
+	using char_type = char;
+	// Codepages only store code points of the BMP.
+	static constexpr size_t cp_units[4] = { 1, 1, 1, 0 };
+	static constexpr uint32_t direct_max = 0x7F;
+
+	static transcode_error decode(
+			const char*& first, const char*, char32_t& cp) {
+		const uint32_t u = unit_value(*first);
+		cp = u < 0x80 ? char32_t(u) : char32_t(Traits::table[u - 0x80]);
+		if (cp == 0 && u != 0) {
+			return transcode_error::invalid;
+		}
+
+		++first;
+		return transcode_error::none;
+	}
+
+	static void count_classes(
+			const char* first, size_t size, size_t (&classes)[4]) {
+		for (size_t& c : classes) {
+			c = 0;
+		}
+
+		// Ascii runs are skipped in blocks, the others use the class table.
+		size_t i = 0;
+		while (i < size) {
+			const size_t ascii_count
+					= direct_prefix<direct_max>(first + i, size - i);
+			classes[0] += ascii_count;
+			i += ascii_count;
+			if (i == size) {
+				break;
+			}
+
+			++classes[high_classes[unit_value(first[i]) - 0x80]];
+			++i;
+		}
+	}
+
+	static constexpr size_t size(char32_t cp) {
+		return cp < 0x80 || reverse.find(cp) != 0 ? 1 : 0;
+	}
+
+	static char* encode(char32_t cp, char* out) {
+		*out++ = char(cp < 0x80 ? uint8_t(cp) : reverse.find(cp));
+		return out;
+	}
+
+private:
+	static constexpr std::array<uint8_t, 128> make_high_classes() {
+		std::array<uint8_t, 128> ret{};
+		for (size_t i = 0; i < ret.size(); ++i) {
+			ret[i] = uint8_t(utf8_codec::size(Traits::table[i]) - 1);
+		}
+		return ret;
+	}
+
+	// The utf8 length class of each upper byte.
+	static constexpr std::array<uint8_t, 128> high_classes
+			= make_high_classes();
+
+	static constexpr auto reverse = make_codepage_reverse_table<
+			codepage_page_count(Traits::table)>(Traits::table);
+};
+
+// ISO-8859-1 bytes are their own code point.
+[[nodiscard]] constexpr codepage_table make_iso_8859_1_table() {
+	codepage_table ret{};
+	for (size_t i = 0; i < ret.size(); ++i) {
+		ret[i] = char16_t(0x80 + i);
+	}
+	return ret;
+}
+
+struct iso_8859_1_table {
+	static constexpr codepage_table table = make_iso_8859_1_table();
+};
+
+// Undefined windows bytes map to C1 controls, like MultiByteToWideChar.
+struct windows_1250_table {
+	static constexpr codepage_table table{ {
+		0x20AC, 0x0081, 0x201A, 0x0083, 0x201E, 0x2026, 0x2020, 0x2021,
+		0x0088, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+		0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+		0x0098, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+		0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+		0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+		0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+		0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+		0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+		0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+		0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+		0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+		0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+		0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+		0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+		0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9,
+	} };
+};
+
+struct windows_1251_table {
+	static constexpr codepage_table table{ {
+		0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+		0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+		0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+		0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+		0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+		0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+		0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+		0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+		0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+		0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+		0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+		0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+		0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+		0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+		0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+		0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+	} };
+};
+
+struct windows_1252_table {
+	static constexpr codepage_table table{ {
+		0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+		0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+		0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+		0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+		0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+		0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+		0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+		0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+		0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+		0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+		0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+		0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+		0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+		0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+		0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+		0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+	} };
+};
+
+struct iso_8859_2_table {
+	static constexpr codepage_table table{ {
+		0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+		0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+		0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+		0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+		0x00A0, 0x0104, 0x02D8, 0x0141, 0x00A4, 0x013D, 0x015A, 0x00A7,
+		0x00A8, 0x0160, 0x015E, 0x0164, 0x0179, 0x00AD, 0x017D, 0x017B,
+		0x00B0, 0x0105, 0x02DB, 0x0142, 0x00B4, 0x013E, 0x015B, 0x02C7,
+		0x00B8, 0x0161, 0x015F, 0x0165, 0x017A, 0x02DD, 0x017E, 0x017C,
+		0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+		0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+		0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+		0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+		0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+		0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+		0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+		0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9,
+	} };
+};
+
+struct iso_8859_5_table {
+	static constexpr codepage_table table{ {
+		0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+		0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+		0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+		0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+		0x00A0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+		0x0408, 0x0409, 0x040A, 0x040B, 0x040C, 0x00AD, 0x040E, 0x040F,
+		0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+		0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+		0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+		0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+		0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+		0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+		0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+		0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+		0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+		0x0458, 0x0459, 0x045A, 0x045B, 0x045C, 0x00A7, 0x045E, 0x045F,
+	} };
+};
+
+struct iso_8859_15_table {
+	static constexpr codepage_table table{ {
+		0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+		0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+		0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+		0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+		0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AC, 0x00A5, 0x0160, 0x00A7,
+		0x0161, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+		0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x017D, 0x00B5, 0x00B6, 0x00B7,
+		0x017E, 0x00B9, 0x00BA, 0x00BB, 0x0152, 0x0153, 0x0178, 0x00BF,
+		0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+		0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+		0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+		0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+		0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+		0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+		0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+		0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+	} };
+};
+
+// The original IBM PC codepage.
+struct cp437_table {
+	static constexpr codepage_table table{ {
+		0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+		0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+		0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+		0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+		0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+		0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+		0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+		0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+		0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+		0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+		0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+		0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+		0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+		0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+		0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+		0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+	} };
+};
+
+// Central European.
+using windows_1250_codec = single_byte_codec<windows_1250_table>;
+// Cyrillic.
+using windows_1251_codec = single_byte_codec<windows_1251_table>;
+// Western European, the usual Windows "ANSI" codepage.
+using windows_1252_codec = single_byte_codec<windows_1252_table>;
+// Latin-1.
+using iso_8859_1_codec = single_byte_codec<iso_8859_1_table>;
+// Latin-2.
+using iso_8859_2_codec = single_byte_codec<iso_8859_2_table>;
+// Cyrillic.
+using iso_8859_5_codec = single_byte_codec<iso_8859_5_table>;
+// Latin-9, Latin-1 with the euro sign.
+using iso_8859_15_codec = single_byte_codec<iso_8859_15_table>;
+using cp437_codec = single_byte_codec<cp437_table>;
+
+enum class codepage : unsigned {
+	windows_1250,
+	windows_1251,
+	windows_1252,
+	iso_8859_1,
+	iso_8859_2,
+	iso_8859_5,
+	iso_8859_15,
+	cp437,
+	count,
+};
+
+// Calls func with a default constructed codec of the codepage, and returns
+// its result. Use it to pick a codepage at runtime.
+template <class Func>
+decltype(auto) visit_codepage(codepage page, Func&& func) {
+	switch (page) {
+	case codepage::windows_1250:
+		return func(windows_1250_codec{});
+	case codepage::windows_1251:
+		return func(windows_1251_codec{});
+	case codepage::windows_1252:
+		return func(windows_1252_codec{});
+	case codepage::iso_8859_1:
+		return func(iso_8859_1_codec{});
+	case codepage::iso_8859_2:
+		return func(iso_8859_2_codec{});
+	case codepage::iso_8859_5:
+		return func(iso_8859_5_codec{});
+	case codepage::iso_8859_15:
+		return func(iso_8859_15_codec{});
+	case codepage::cp437:
+		return func(cp437_codec{});
+	default:
+		break;
+	}
+	throw std::invalid_argument{ "visit_codepage : unknown codepage" };
+}
+} // namespace fea
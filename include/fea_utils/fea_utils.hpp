@@ -1,7 +1,12 @@
 ﻿#pragma once
+#include "fea_utils/char_set.hpp"
+#include "fea_utils/codepage.hpp"
 #include "fea_utils/file.hpp"
+#include "fea_utils/mapped_file.hpp"
 #include "fea_utils/memory.hpp"
+#include "fea_utils/multi_searcher.hpp"
 #include "fea_utils/platform.hpp"
 #include "fea_utils/scope.hpp"
 #include "fea_utils/string.hpp"
 #include "fea_utils/thread.hpp"
+#include "fea_utils/unicode.hpp"
@@ -32,14 +32,41 @@
  **/
 
 #pragma once
+#include "fea_utils/mapped_file.hpp"
 #include "fea_utils/platform.hpp"
+#include "fea_utils/scope.hpp"
 #include "fea_utils/string.hpp"
+#include "fea_utils/thread.hpp"
 
 #include <filesystem>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(FEA_WINDOWS)
+#include <windows.h>
+#elif defined(FEA_POSIX)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace fea {
 // Returns the executable's directory. You must provide argv[0].
@@ -76,63 +103,302 @@ size_t file_size(IFStream& ifs) {
 }
 
 
-template <class IFStream, class String, class Func>
-bool basic_read_text_file(const std::filesystem::path& fpath, Func func) {
-	IFStream ifs(fpath);
+// Block size used by the buffered readers.
+inline constexpr size_t file_chunk_size = 1024 * 1024;
+
+// Reads the file in large blocks and calls your function for every line.
+// Removes linefeeds, including crlfs split across blocks.
+// Bytes are widened as-is when CharT is wider than char.
+// The lines point in a reused buffer, copy them if you need to keep them.
+// Pass in void(std::basic_string_view<CharT>)
+template <class CharT, class Func>
+bool basic_read_text_lines(const std::filesystem::path& fpath, Func func,
+		size_t chunk_size = file_chunk_size) {
+	std::ifstream ifs(fpath, std::ios::binary);
 	if (!ifs.is_open()) {
 		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
 		return false;
 	}
 
-	String line;
-	while (std::getline(ifs, line)) {
-		if (line.size() > 0 && line.back() == '\r') {
-			line.pop_back();
+	std::vector<char> buf(std::max(chunk_size, size_t(1)));
+	std::basic_string<CharT> wide_line;
+
+	auto emit = [&](const char* first, size_t size) {
+		if (size > 0 && first[size - 1] == '\r') {
+			--size;
+		}
+
+		if constexpr (std::is_same_v<CharT, char>) {
+			std::invoke(func, std::string_view{ first, size });
+		} else {
+			wide_line.resize(size);
+			for (size_t i = 0; i < size; ++i) {
+				wide_line[i] = CharT(uint8_t(first[i]));
+			}
+			std::invoke(func, std::basic_string_view<CharT>{ wide_line });
+		}
+	};
+
+	// Bytes in the buffer, which always start at the beginning of a line.
+	size_t filled = 0;
+	while (true) {
+		if (filled == buf.size()) {
+			// The line doesn't fit, grow.
+			buf.resize(buf.size() * 2);
+		}
+
+		ifs.read(buf.data() + filled, std::streamsize(buf.size() - filled));
+		size_t read_count = size_t(ifs.gcount());
+		if (read_count == 0) {
+			break;
+		}
+
+		// Only scan the new bytes, the carried-over ones have no linefeed.
+		const char* first = buf.data();
+		size_t line_start = 0;
+		size_t scan_start = filled;
+		filled += read_count;
+
+		while (scan_start < filled) {
+			const void* lf = std::memchr(
+					first + scan_start, '\n', filled - scan_start);
+			if (lf == nullptr) {
+				break;
+			}
+
+			size_t pos = size_t(static_cast<const char*>(lf) - first);
+			emit(first + line_start, pos - line_start);
+			line_start = pos + 1;
+			scan_start = line_start;
+		}
+
+		// Carry the incomplete line over to the next block.
+		filled -= line_start;
+		if (line_start != 0 && filled != 0) {
+			std::memmove(buf.data(), buf.data() + line_start, filled);
 		}
-		std::invoke(func, std::move(line));
+	}
+
+	if (filled != 0) {
+		emit(buf.data(), filled);
 	}
 	return true;
 }
 
+// Narrow files go through the chunked reader. Wide files are read with
+// IFStream, so its locale conversion applies.
+template <class IFStream, class String, class Func>
+bool basic_read_text_file(const std::filesystem::path& fpath, Func func) {
+	using char_t = typename String::value_type;
+	using view_t = std::basic_string_view<char_t>;
+
+	if constexpr (std::is_same_v<char_t, char>) {
+		if constexpr (std::is_invocable_v<Func, view_t>) {
+			return basic_read_text_lines<char_t>(fpath, func);
+		} else {
+			return basic_read_text_lines<char_t>(fpath,
+					[&](view_t line) { std::invoke(func, String{ line }); });
+		}
+	} else {
+		IFStream ifs(fpath);
+		if (!ifs.is_open()) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		String line;
+		while (std::getline(ifs, line)) {
+			if (line.size() > 0 && line.back() == char_t('\r')) {
+				line.pop_back();
+			}
+
+			if constexpr (std::is_invocable_v<Func, view_t>) {
+				std::invoke(func, view_t{ line });
+			} else {
+				std::invoke(func, std::move(line));
+			}
+		}
+		return true;
+	}
+}
+
 // Calls your function for every line in a text file. Removes linefeeds.
-// Pass in void(std::string&&)
+// Pass in void(std::string_view) to skip per-line allocations,
+// or void(std::string&&)
 template <class Func>
 bool read_text_file(const std::filesystem::path& fpath, Func func) {
 	return basic_read_text_file<std::ifstream, std::string>(fpath, func);
 }
 // Calls your function for every line in a text file. Removes linefeeds.
-// Pass in void(std::wstring&&)
+// Pass in void(std::wstring_view) to skip per-line allocations,
+// or void(std::wstring&&)
 template <class Func>
 bool wread_text_file(const std::filesystem::path& fpath, Func func) {
 	return basic_read_text_file<std::wifstream, std::wstring>(fpath, func);
 }
 
+// Calls your function for every line in the text. Removes linefeeds.
+// The lines point inside the text, nothing is copied.
+// Pass in void(std::basic_string_view<CharT>)
+template <class CharT, class Func>
+void for_each_line(std::basic_string_view<CharT> text, Func func) {
+	using view_t = std::basic_string_view<CharT>;
+
+	size_t prev = 0;
+	while (prev < text.size()) {
+		size_t pos = text.find(CharT('\n'), prev);
+		if (pos == view_t::npos) {
+			pos = text.size();
+		}
 
-template <class IFStream, class String, class UInt>
-bool basic_open_text_file(
-		const std::filesystem::path& fpath, std::vector<UInt>& out) {
-	IFStream ifs(fpath, std::ios::ate);
-	if (!ifs.is_open()) {
-		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
+		view_t line = text.substr(prev, pos - prev);
+		if (line.size() > 0 && line.back() == CharT('\r')) {
+			line.remove_suffix(1);
+		}
+		std::invoke(func, line);
+		prev = pos + 1;
+	}
+}
+
+// Calls your function for every line in a mapped file. Removes linefeeds.
+// Pass in void(std::string_view), the lines point inside the mapping.
+template <class Func>
+bool read_text_file(const mapped_file& file, Func func) {
+	if (!file.is_open()) {
 		return false;
 	}
 
-	out = {};
-	out.reserve(file_size(ifs));
+	for_each_line(file.view(), func);
+	return true;
+}
 
-	String line;
-	while (std::getline(ifs, line)) {
-		if (line.size() > 0 && line.back() == '\r') {
-			line.pop_back();
+// Splits the text in one range of whole lines per thread, and calls your
+// function concurrently with each range.
+// If your function throws, the first exception is rethrown once every
+// range is done.
+// Pass in void(std::string_view lines, size_t thread_idx)
+template <class Func>
+void parallel_for_line_ranges(std::string_view text, Func func) {
+	// Lines belong to the range in which they start.
+	auto snap = [&](size_t idx) {
+		if (idx == 0 || idx >= text.size()) {
+			return std::min(idx, text.size());
 		}
 
-		for (auto c : line) {
-			out.push_back(static_cast<UInt>(c));
-		}
+		size_t pos = text.find('\n', idx - 1);
+		return pos == std::string_view::npos ? text.size() : pos + 1;
+	};
+
+	// Worker threads can't throw, the first exception is kept for later.
+	std::mutex error_mtx;
+	std::exception_ptr error;
+
+	parallel_for(text.size(),
+			[&](const std::pair<size_t, size_t>& range, size_t thread_idx) {
+				try {
+					size_t first = snap(range.first);
+					size_t last = snap(range.second);
+					if (first < last) {
+						std::invoke(func, text.substr(first, last - first),
+								thread_idx);
+					}
+				} catch (...) {
+					std::unique_lock l{ error_mtx };
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			});
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// Calls your function for every line in a mapped file, from multiple threads.
+// Lines aren't processed in order. Removes linefeeds.
+// Pass in void(std::string_view line, size_t thread_idx)
+template <class Func>
+bool parallel_read_text_file(const mapped_file& file, Func func) {
+	if (!file.is_open()) {
+		return false;
+	}
+
+	parallel_for_line_ranges(
+			file.view(), [&](std::string_view lines, size_t thread_idx) {
+				for_each_line(lines, [&](std::string_view line) {
+					std::invoke(func, line, thread_idx);
+				});
+			});
+	return true;
+}
+
+// Calls your function for every line in a text file, from multiple threads.
+// Lines aren't processed in order. Removes linefeeds.
+// Pass in void(std::string_view line, size_t thread_idx)
+template <class Func>
+bool parallel_read_text_file(const std::filesystem::path& fpath, Func func) {
+	mapped_file file{ fpath, mapped_file_mode::read_only,
+		mapped_file_hint::sequential };
+	return parallel_read_text_file(file, func);
+}
+
+// Calls your function for every line in a mapped file, from multiple threads.
+// Each thread accumulates its lines in its own result. The results are stored
+// in file order, one per thread. Removes linefeeds.
+// Pass in void(std::string_view line, T& thread_result)
+template <class T, class Func>
+bool parallel_read_text_file(
+		const mapped_file& file, std::vector<T>& out, Func func) {
+	out = std::vector<T>(num_threads());
+	if (!file.is_open()) {
+		return false;
 	}
+
+	parallel_for_line_ranges(
+			file.view(), [&](std::string_view lines, size_t thread_idx) {
+				T& result = out[thread_idx];
+				for_each_line(lines, [&](std::string_view line) {
+					std::invoke(func, line, result);
+				});
+			});
 	return true;
 }
 
+// Calls your function for every line in a text file, from multiple threads.
+// Each thread accumulates its lines in its own result. The results are stored
+// in file order, one per thread. Removes linefeeds.
+// Pass in void(std::string_view line, T& thread_result)
+template <class T, class Func>
+bool parallel_read_text_file(
+		const std::filesystem::path& fpath, std::vector<T>& out, Func func) {
+	mapped_file file{ fpath, mapped_file_mode::read_only,
+		mapped_file_hint::sequential };
+	return parallel_read_text_file(file, out, func);
+}
+
+
+template <class IFStream, class String, class UInt>
+bool basic_open_text_file(
+		const std::filesystem::path& fpath, std::vector<UInt>& out) {
+	using char_t = typename String::value_type;
+
+	out = {};
+	std::error_code ec;
+	uintmax_t size = std::filesystem::file_size(fpath, ec);
+	if (!ec) {
+		out.reserve(size_t(size));
+	}
+
+	return basic_read_text_file<IFStream, String>(
+			fpath, [&](std::basic_string_view<char_t> line) {
+				for (char_t c : line) {
+					out.push_back(static_cast<UInt>(c));
+				}
+			});
+}
+
 // Opens the text file as unsigned, and stores it in out.
 // The output is a text blob (no linefeeds).
 inline bool open_text_file(
@@ -150,14 +416,17 @@ inline bool wopen_text_file(
 template <class IFStream, class String, class UInt>
 bool basic_open_text_file(const std::filesystem::path& fpath,
 		std::vector<std::vector<UInt>>& out) {
-	out = {};
+	using char_t = typename String::value_type;
 
-	return basic_read_text_file<IFStream, String>(fpath, [&](String&& line) {
-		out.push_back({});
-		for (auto c : line) {
-			out.back().push_back(static_cast<UInt>(c));
-		}
-	});
+	out = {};
+	return basic_read_text_file<IFStream, String>(
+			fpath, [&](std::basic_string_view<char_t> line) {
+				out.push_back({});
+				out.back().reserve(line.size());
+				for (char_t c : line) {
+					out.back().push_back(static_cast<UInt>(c));
+				}
+			});
 }
 
 // Opens text file and files the vector of vector with each line converted to
@@ -207,9 +476,13 @@ template <class IFStream, class String, class Alloc,
 		template <class, class> class Vec>
 bool basic_open_text_file(
 		const std::filesystem::path& fpath, Vec<String, Alloc>& out) {
+	using char_t = typename String::value_type;
+
 	out = {};
 	return basic_read_text_file<IFStream, String>(
-			fpath, [&](String&& line) { out.push_back(line); });
+			fpath, [&](std::basic_string_view<char_t> line) {
+				out.emplace_back(line);
+			});
 }
 
 // Opens the text file and each line in the vector.
@@ -222,204 +495,1694 @@ inline bool wopen_text_file(
 		const std::filesystem::path& fpath, std::vector<std::wstring>& out) {
 	return basic_open_text_file<std::wifstream>(fpath, out);
 }
+// Stores a view of each line of the mapped file in the vector.
+// The views are valid as long as the mapping is.
+inline bool open_text_file(
+		const mapped_file& file, std::vector<std::string_view>& out) {
+	out = {};
+	return read_text_file(
+			file, [&](std::string_view line) { out.push_back(line); });
+}
 
 
-template <class IFStream, class String>
-bool open_text_file_raw(const std::filesystem::path& fpath, String& out) {
-	IFStream ifs(fpath, std::ios::ate | std::ios::binary);
-	if (!ifs.is_open()) {
-		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
-		return false;
+// Stores lines back to back in one buffer, with the offsets of their ends.
+// Much lighter than a vector of strings when there are many small lines.
+template <class CharT>
+struct basic_line_table {
+	using value_type = std::basic_string_view<CharT>;
+	using size_type = size_t;
+
+	struct const_iterator {
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::basic_string_view<CharT>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = value_type;
+
+		const_iterator() = default;
+		const_iterator(const basic_line_table* table, size_t idx)
+				: _table(table)
+				, _idx(idx) {
+		}
+
+		value_type operator*() const {
+			return (*_table)[_idx];
+		}
+		value_type operator[](difference_type n) const {
+			return (*_table)[size_t(difference_type(_idx) + n)];
+		}
+
+		const_iterator& operator++() {
+			++_idx;
+			return *this;
+		}
+		const_iterator operator++(int) {
+			const_iterator ret = *this;
+			++_idx;
+			return ret;
+		}
+		const_iterator& operator--() {
+			--_idx;
+			return *this;
+		}
+		const_iterator operator--(int) {
+			const_iterator ret = *this;
+			--_idx;
+			return ret;
+		}
+
+		const_iterator& operator+=(difference_type n) {
+			_idx = size_t(difference_type(_idx) + n);
+			return *this;
+		}
+		const_iterator& operator-=(difference_type n) {
+			_idx = size_t(difference_type(_idx) - n);
+			return *this;
+		}
+		const_iterator operator+(difference_type n) const {
+			return const_iterator{ _table, size_t(difference_type(_idx) + n) };
+		}
+		const_iterator operator-(difference_type n) const {
+			return const_iterator{ _table, size_t(difference_type(_idx) - n) };
+		}
+		difference_type operator-(const const_iterator& other) const {
+			return difference_type(_idx) - difference_type(other._idx);
+		}
+
+		bool operator==(const const_iterator& other) const {
+			return _idx == other._idx;
+		}
+		bool operator!=(const const_iterator& other) const {
+			return _idx != other._idx;
+		}
+		bool operator<(const const_iterator& other) const {
+			return _idx < other._idx;
+		}
+
+	private:
+		const basic_line_table* _table{ nullptr };
+		size_t _idx{ 0 };
+	};
+	using iterator = const_iterator;
+
+	// Number of lines.
+	[[nodiscard]] size_t size() const {
+		return _ends.size();
+	}
+
+	[[nodiscard]] bool empty() const {
+		return _ends.empty();
 	}
 
-	out = String(file_size(ifs), '\0');
-	ifs.read(out.data(), out.size());
+	[[nodiscard]] value_type operator[](size_t idx) const {
+		assert(idx < size());
+		size_t beg = idx == 0 ? 0 : _ends[idx - 1];
+		return value_type{ _buffer.data() + beg, _ends[idx] - beg };
+	}
 
-	using c_t = typename String::value_type;
-	size_t pos = out.find(c_t{}); // The real end is always screwed up.
+	[[nodiscard]] value_type front() const {
+		return (*this)[0];
+	}
 
-	if (pos != String::npos) {
-		out.resize(pos);
+	[[nodiscard]] value_type back() const {
+		return (*this)[size() - 1];
 	}
-	return true;
+
+	[[nodiscard]] const_iterator begin() const {
+		return const_iterator{ this, 0 };
+	}
+
+	[[nodiscard]] const_iterator end() const {
+		return const_iterator{ this, size() };
+	}
+
+	// All the lines, back to back.
+	[[nodiscard]] value_type text() const {
+		return value_type{ _buffer };
+	}
+
+	void reserve(size_t line_count, size_t char_count) {
+		_ends.reserve(line_count);
+		_buffer.reserve(char_count);
+	}
+
+	void push_back(value_type line) {
+		_buffer.append(line);
+		_ends.push_back(_buffer.size());
+	}
+
+	void clear() {
+		_buffer.clear();
+		_ends.clear();
+	}
+
+	void shrink_to_fit() {
+		_buffer.shrink_to_fit();
+		_ends.shrink_to_fit();
+	}
+
+private:
+	std::basic_string<CharT> _buffer;
+	std::vector<size_t> _ends;
+};
+
+using line_table = basic_line_table<char>;
+using wline_table = basic_line_table<wchar_t>;
+
+template <class CharT>
+bool basic_open_text_file(
+		const std::filesystem::path& fpath, basic_line_table<CharT>& out) {
+	out.clear();
+
+	// Linefeeds aren't stored, so the file size is an upper bound.
+	std::error_code ec;
+	uintmax_t size = std::filesystem::file_size(fpath, ec);
+	if (!ec) {
+		out.reserve(0, size_t(size));
+	}
+
+	return basic_read_text_file<std::basic_ifstream<CharT>,
+			std::basic_string<CharT>>(fpath,
+			[&](std::basic_string_view<CharT> line) { out.push_back(line); });
 }
 
-// Opens the text file as-is (without parsing) and stores it in out.
-// Fastest option.
-inline bool open_text_file_raw(
-		const std::filesystem::path& fpath, std::string& out) {
-	return open_text_file_raw<std::ifstream>(fpath, out);
+// Opens the text file and stores each line in the table.
+inline bool open_text_file(
+		const std::filesystem::path& fpath, line_table& out) {
+	return basic_open_text_file(fpath, out);
 }
-// Opens the text file as-is (without parsing) and stores it in out.
-// Fastest option.
-inline bool wopen_text_file_raw(
-		const std::filesystem::path& fpath, std::wstring& out) {
-	return open_text_file_raw<std::wifstream>(fpath, out);
+// Opens the text file and stores each line in the table.
+inline bool wopen_text_file(
+		const std::filesystem::path& fpath, wline_table& out) {
+	return basic_open_text_file(fpath, out);
+}
+// Stores each line of the mapped file in the table.
+inline bool open_text_file(const mapped_file& file, line_table& out) {
+	out.clear();
+	out.reserve(0, file.size());
+	return read_text_file(
+			file, [&](std::string_view line) { out.push_back(line); });
 }
 
-// Opens binary file and stores bytes in vector.
-inline bool open_binary_file(
-		const std::filesystem::path& f, std::vector<uint8_t>& out) {
-	std::ifstream ifs{ f, std::ios::binary | std::ios::ate };
-	if (!ifs.is_open()) {
-		fprintf(stderr, "Couldn't open file '%s'\n", f.string().c_str());
-		return false;
+
+// A growable byte buffer which leaves new memory uninitialized.
+// Reuse it to load many files without reallocating or zero-filling.
+struct file_buffer {
+	file_buffer() = default;
+	explicit file_buffer(size_t capacity) {
+		reserve(capacity);
 	}
 
-	out = std::vector<uint8_t>(file_size(ifs));
-	ifs.read(reinterpret_cast<char*>(out.data()), out.size());
-	return true;
-}
+	[[nodiscard]] uint8_t* data() {
+		return _data.get();
+	}
+	[[nodiscard]] const uint8_t* data() const {
+		return _data.get();
+	}
 
+	[[nodiscard]] size_t size() const {
+		return _size;
+	}
 
-enum class text_encoding {
-	utf32be,
-	utf32le,
-	utf16be,
-	utf16le,
-	utf8,
-	count,
-};
+	[[nodiscard]] size_t capacity() const {
+		return _capacity;
+	}
 
-inline bool reconstruct_text_file(const std::string& input_str,
-		text_encoding encoding, std::u32string& output_str) {
+	[[nodiscard]] bool empty() const {
+		return _size == 0;
+	}
 
-	switch (encoding) {
-	case text_encoding::utf32be: {
-		if (input_str.size() % 4 != 0) {
-			return false;
-		}
+	[[nodiscard]] const uint8_t* begin() const {
+		return _data.get();
+	}
 
-		size_t count = input_str.size() / 4;
-		std::u32string temp(count, 0);
+	[[nodiscard]] const uint8_t* end() const {
+		return _data.get() + _size;
+	}
 
-		for (size_t i = 0; i < count; ++i) {
-			temp[i] = static_cast<char32_t>(input_str[i * 4 + 3] << 0
-					| input_str[i * 4 + 2] << 8 | input_str[i * 4 + 1] << 16
-					| input_str[i * 4 + 0] << 24);
-		}
+	// The contents as chars.
+	[[nodiscard]] std::string_view view() const {
+		return { reinterpret_cast<const char*>(_data.get()), _size };
+	}
 
-		// Do this "dummy" conversion to test conversion was ok.
-		try {
-			std::string utf8 = utf32_to_utf8(temp);
-			output_str = utf8_to_utf32(utf8);
-		} catch (const std::range_error&) {
-			output_str.clear();
-			return false;
-		}
-	} break;
-	case text_encoding::utf32le: {
-		if (input_str.size() % 4 != 0) {
-			return false;
+	// Keeps the contents, new bytes are left uninitialized.
+	void reserve(size_t capacity) {
+		if (capacity <= _capacity) {
+			return;
 		}
 
-		size_t count = input_str.size() / 4;
-		std::u32string temp(count, 0);
-		for (size_t i = 0; i < count; ++i) {
-			temp[i] = static_cast<char32_t>(input_str[i * 4 + 0] << 0
-					| input_str[i * 4 + 1] << 8 | input_str[i * 4 + 2] << 16
-					| input_str[i * 4 + 3] << 24);
+		std::unique_ptr<uint8_t[]> new_data{ new uint8_t[capacity] };
+		if (_size != 0) {
+			std::memcpy(new_data.get(), _data.get(), _size);
 		}
+		_data = std::move(new_data);
+		_capacity = capacity;
+	}
 
-		try {
-			std::string utf8 = utf32_to_utf8(temp);
-			output_str = utf8_to_utf32(utf8);
-		} catch (const std::range_error&) {
-			output_str.clear();
-			return false;
-		}
-	} break;
-	case text_encoding::utf16be: {
-		if (input_str.size() % 2 != 0) {
-			return false;
-		}
+	// New bytes are left uninitialized.
+	void resize(size_t size) {
+		reserve(size);
+		_size = size;
+	}
 
-		size_t count = input_str.size() / 2;
-		std::u16string temp(count, 0);
-		for (size_t i = 0; i < count; ++i) {
-			temp[i] = static_cast<char16_t>(
-					input_str[i * 2 + 1] << 0 | input_str[i * 2 + 0] << 8);
-		}
+	// Keeps the memory.
+	void clear() {
+		_size = 0;
+	}
 
-		try {
-			output_str = utf16_to_utf32(temp);
-		} catch (const std::range_error&) {
-			output_str.clear();
-			return false;
-		}
-	} break;
-	case text_encoding::utf16le: {
-		if (input_str.size() % 2 != 0) {
-			return false;
+private:
+	std::unique_ptr<uint8_t[]> _data;
+	size_t _size{ 0 };
+	size_t _capacity{ 0 };
+};
+
+struct read_file_options {
+	// Maximum bytes per read call.
+	size_t chunk_size = file_chunk_size;
+
+	// Byte offset at which to start reading.
+	uint64_t offset = 0;
+
+	// Reads at most this many bytes.
+	size_t max_size = std::numeric_limits<size_t>::max();
+
+	// Append to the buffer instead of replacing its contents.
+	bool append = false;
+};
+
+// Reads the file (or a part of it) in out. Buffer must provide data(),
+// size() and resize(). Once done, out is resized to the exact byte count.
+// The size comes from the file system, the file is read in big blocks,
+// straight into out.
+template <class Buffer>
+bool basic_read_file_into(const std::filesystem::path& fpath, Buffer& out,
+		const read_file_options& opts = {}) {
+	static_assert(sizeof(*out.data()) == 1, "buffer must store bytes");
+
+	const size_t start = opts.append ? out.size() : 0;
+	const size_t chunk_size = std::max(opts.chunk_size, size_t(1));
+
+	// Resizes to fit the size, or doubles when the size is unknown.
+	size_t capacity = 0;
+	bool known_size = false;
+	auto grow = [&](uint64_t fsize) {
+		if (known_size) {
+			uint64_t remaining = fsize > opts.offset ? fsize - opts.offset : 0;
+			capacity = size_t(std::min(remaining, uint64_t(opts.max_size)));
+		} else {
+			capacity = std::min(std::max(capacity * 2, chunk_size),
+					opts.max_size);
 		}
+		out.resize(start + capacity);
+	};
+
+	size_t done = 0;
+
+#if defined(FEA_WINDOWS)
+	HANDLE file = CreateFileW(fpath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
+		return false;
+	}
 
-		size_t count = input_str.size() / 2;
-		std::u16string temp(count, 0);
-		for (size_t i = 0; i < count; ++i) {
-			temp[i] = static_cast<char16_t>(
-					input_str[i * 2 + 0] << 0 | input_str[i * 2 + 1] << 8);
+	LARGE_INTEGER fsize{};
+	known_size = GetFileSizeEx(file, &fsize) && fsize.QuadPart > 0;
+	grow(uint64_t(fsize.QuadPart));
+
+	while (true) {
+		if (done == capacity) {
+			if (known_size || capacity == opts.max_size) {
+				break;
+			}
+			grow(0);
 		}
 
-		try {
-			output_str = utf16_to_utf32(temp);
-		} catch (const std::range_error&) {
-			output_str.clear();
+		uint64_t pos = opts.offset + done;
+		OVERLAPPED ov{};
+		ov.Offset = DWORD(pos & 0xFFFFFFFF);
+		ov.OffsetHigh = DWORD(pos >> 32);
+
+		DWORD to_read = DWORD(std::min(
+				std::min(chunk_size, capacity - done), size_t(1) << 30));
+		DWORD read_count = 0;
+		if (!ReadFile(file, reinterpret_cast<char*>(out.data()) + start + done,
+					to_read, &read_count, &ov)) {
+			if (GetLastError() == ERROR_HANDLE_EOF) {
+				break;
+			}
+			CloseHandle(file);
+			out.resize(start);
+			fprintf(stderr, "Couldn't read file : %s\n",
+					fpath.string().c_str());
 			return false;
 		}
-	} break;
-	case text_encoding::utf8: {
-		try {
-			output_str = utf8_to_utf32(input_str);
-		} catch (const std::range_error&) {
-			output_str.clear();
-			return false;
+
+		if (read_count == 0) {
+			break;
 		}
-	} break;
-	default: {
+		done += size_t(read_count);
+	}
+	CloseHandle(file);
+
+#elif defined(FEA_POSIX)
+	int fd = ::open(fpath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
 		return false;
-	} break;
 	}
 
-	return true;
-}
+	// Some special files report a size of 0, read those until eof.
+	struct stat st {};
+	known_size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+	grow(uint64_t(st.st_size));
 
-// Based on :
-// https://www.codeproject.com/Tips/672470/Simple-Character-Encoding-Detection
-inline text_encoding detect_encoding(const std::string& str) {
-	// 1. If a string doesn't contain nulls, its UTF-8
-	if (str.find('\0') == std::string::npos) {
-		return text_encoding::utf8;
-	}
+	while (true) {
+		if (done == capacity) {
+			if (known_size || capacity == opts.max_size) {
+				break;
+			}
+			grow(0);
+		}
 
-	// else
-	// 2. If a string doesn't contain double nulls, it's UTF-16
-	std::string double_null("\0\0", 2);
-	if (str.find(double_null) == std::string::npos) {
-		// 3. If the nulls are on odd numbered indices, it's UTF-16LE
-		for (size_t i = 0; i < str.size(); ++i) {
-			if (str[i] == '\0' && (i % 2) != 0) {
-				return text_encoding::utf16le;
+		ssize_t read_count = pread(fd,
+				reinterpret_cast<char*>(out.data()) + start + done,
+				std::min(chunk_size, capacity - done),
+				off_t(opts.offset + done));
+		if (read_count < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
+			::close(fd);
+			out.resize(start);
+			fprintf(stderr, "Couldn't read file : %s\n",
+					fpath.string().c_str());
+			return false;
 		}
 
-		// else
-		// 4. The string defaults to UTF-16BE
-		return text_encoding::utf16be;
+		if (read_count == 0) {
+			break;
+		}
+		done += size_t(read_count);
 	}
+	::close(fd);
 
-	// Files are not stored as utf32, so don't support that detection. At least
-	// for now.
-	return text_encoding::count;
+#else
+	std::ifstream ifs{ fpath, std::ios::binary | std::ios::ate };
+	if (!ifs.is_open()) {
+		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
+		return false;
+	}
+
+	std::streamoff fsize = ifs.tellg();
+	known_size = fsize > 0;
+	grow(uint64_t(std::max(fsize, std::streamoff(0))));
+	ifs.seekg(std::streamoff(opts.offset), ifs.beg);
+
+	while (ifs) {
+		if (done == capacity) {
+			if (known_size || capacity == opts.max_size) {
+				break;
+			}
+			grow(0);
+		}
+
+		ifs.read(reinterpret_cast<char*>(out.data()) + start + done,
+				std::streamsize(std::min(chunk_size, capacity - done)));
+		done += size_t(ifs.gcount());
+	}
+#endif
+
+	// The file may have shrunk, or size was unknown.
+	out.resize(start + done);
+	return true;
+}
+
+// Reads the whole file in a reusable buffer, without initializing it first.
+inline bool read_file_into(const std::filesystem::path& fpath,
+		file_buffer& out, const read_file_options& opts = {}) {
+	return basic_read_file_into(fpath, out, opts);
+}
+// Reads the whole file in a vector.
+inline bool read_file_into(const std::filesystem::path& fpath,
+		std::vector<uint8_t>& out, const read_file_options& opts = {}) {
+	return basic_read_file_into(fpath, out, opts);
+}
+// Reads the whole file in a string.
+inline bool read_file_into(const std::filesystem::path& fpath,
+		std::string& out, const read_file_options& opts = {}) {
+	return basic_read_file_into(fpath, out, opts);
+}
+
+struct load_files_options {
+	// Maximum number of files being read at once. 0 uses num_threads().
+	size_t max_in_flight = 0;
+};
+
+// Loads the files concurrently, so their latencies overlap.
+// Calls your function as each file completes, from the worker threads.
+// Every worker reuses its buffer, copy the data if you need to keep it.
+// Returns false if any file couldn't be read, your function isn't called for
+// those.
+// If your function throws, the remaining files are skipped and the first
+// exception is rethrown once the workers are joined.
+// Pass in void(size_t path_idx, const file_buffer& data)
+template <class Func>
+bool load_files(const std::vector<std::filesystem::path>& fpaths, Func func,
+		const load_files_options& opts = {}) {
+	size_t thread_count
+			= opts.max_in_flight == 0 ? num_threads() : opts.max_in_flight;
+	thread_count = std::min(thread_count, fpaths.size());
+
+	std::atomic<size_t> next_idx{ 0 };
+	std::atomic<bool> success{ true };
+	std::atomic<bool> stop{ false };
+	std::mutex error_mtx;
+	std::exception_ptr error;
+
+	auto worker = [&]() {
+		try {
+			file_buffer buf;
+			while (!stop) {
+				size_t idx = next_idx.fetch_add(1);
+				if (idx >= fpaths.size()) {
+					return;
+				}
+
+				if (!read_file_into(fpaths[idx], buf)) {
+					success = false;
+					continue;
+				}
+				std::invoke(func, idx, static_cast<const file_buffer&>(buf));
+			}
+		} catch (...) {
+			std::unique_lock l{ error_mtx };
+			if (!error) {
+				error = std::current_exception();
+			}
+			stop = true;
+		}
+	};
+
+	{
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count);
+
+		// Joins the workers, even if launching one throws.
+		on_exit joiner{ [&]() {
+			stop = stop || threads.size() != thread_count;
+			for (std::thread& t : threads) {
+				t.join();
+			}
+		} };
+
+		for (size_t i = 0; i < thread_count; ++i) {
+			threads.emplace_back(worker);
+		}
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return success;
+}
+
+struct async_read_options {
+	// Size of each buffer.
+	size_t chunk_size = file_chunk_size;
+
+	// Number of rotating buffers. The reader thread blocks once they are all
+	// filled and waiting to be consumed.
+	size_t buffer_count = 3;
+};
+
+// Reads the file on a background thread, in rotating buffers. Calls your
+// function with every chunk, in order, while the next ones are being read.
+// The chunk memory is reused once your function returns.
+// Pass in void(const uint8_t* data, size_t size)
+template <class Func>
+bool async_read_binary_file(const std::filesystem::path& fpath, Func func,
+		const async_read_options& opts = {}) {
+	std::ifstream ifs{ fpath, std::ios::binary };
+	if (!ifs.is_open()) {
+		fprintf(stderr, "Couldn't open file : %s\n", fpath.string().c_str());
+		return false;
+	}
+
+	const size_t chunk_size = std::max(opts.chunk_size, size_t(1));
+	const size_t buffer_count = std::max(opts.buffer_count, size_t(2));
+	std::vector<file_buffer> buffers(buffer_count);
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	size_t produced = 0;
+	size_t consumed = 0;
+	bool done = false;
+	bool stop = false;
+	bool failed = false;
+
+	std::thread io_thread{ [&]() {
+		for (size_t i = 0;; ++i) {
+			{
+				std::unique_lock l{ mtx };
+				cv.wait(l, [&]() {
+					return stop || i - consumed < buffer_count;
+				});
+				if (stop) {
+					return;
+				}
+			}
+
+			// This buffer isn't shared until produced is incremented.
+			file_buffer& buf = buffers[i % buffer_count];
+			buf.resize(chunk_size);
+			ifs.read(reinterpret_cast<char*>(buf.data()),
+					std::streamsize(chunk_size));
+			buf.resize(size_t(ifs.gcount()));
+
+			{
+				std::unique_lock l{ mtx };
+				if (!buf.empty()) {
+					++produced;
+				}
+				if (buf.empty() || !ifs) {
+					done = true;
+					failed = ifs.bad();
+				}
+			}
+			cv.notify_all();
+
+			if (done) {
+				return;
+			}
+		}
+	} };
+
+	// Stops and joins the reader, even if your function throws.
+	on_exit joiner{ [&]() {
+		{
+			std::unique_lock l{ mtx };
+			stop = true;
+		}
+		cv.notify_all();
+		io_thread.join();
+	} };
+
+	for (size_t i = 0;; ++i) {
+		{
+			std::unique_lock l{ mtx };
+			cv.wait(l, [&]() { return produced > i || done; });
+			if (produced <= i) {
+				break;
+			}
+		}
+
+		const file_buffer& buf = buffers[i % buffer_count];
+		std::invoke(func, buf.data(), buf.size());
+
+		{
+			std::unique_lock l{ mtx };
+			++consumed;
+		}
+		cv.notify_all();
+	}
+
+	if (failed) {
+		fprintf(stderr, "Couldn't read file : %s\n", fpath.string().c_str());
+		return false;
+	}
+	return true;
+}
+
+// Reads the file on a background thread and calls your function for every
+// line, while the next chunks are being read. Removes linefeeds.
+// Pass in void(std::string_view)
+template <class Func>
+bool async_read_text_file(const std::filesystem::path& fpath, Func func,
+		const async_read_options& opts = {}) {
+	// Holds lines split across chunks.
+	std::string carry;
+
+	bool ret = async_read_binary_file(
+			fpath,
+			[&](const uint8_t* data, size_t size) {
+				std::string_view chunk{ reinterpret_cast<const char*>(data),
+					size };
+
+				size_t first_lf = chunk.find('\n');
+				if (first_lf == std::string_view::npos) {
+					carry.append(chunk);
+					return;
+				}
+
+				if (!carry.empty()) {
+					carry.append(chunk.substr(0, first_lf + 1));
+					for_each_line(std::string_view{ carry }, func);
+					carry.clear();
+				} else {
+					for_each_line(chunk.substr(0, first_lf + 1), func);
+				}
+
+				size_t last_lf = chunk.rfind('\n');
+				for_each_line(
+						chunk.substr(first_lf + 1, last_lf - first_lf), func);
+				carry.assign(chunk.substr(last_lf + 1));
+			},
+			opts);
+
+	if (ret && !carry.empty()) {
+		for_each_line(std::string_view{ carry }, func);
+	}
+	return ret;
+}
+
+
+
+// Reads the file as-is in any string, through read_file_into.
+// Byte strings are read in place, each byte is widened to one character for
+// wider strings. IFStream is unused, it is kept for existing callers.
+template <class IFStream, class String>
+bool open_text_file_raw(const std::filesystem::path& fpath, String& out) {
+	if constexpr (sizeof(typename String::value_type) == 1) {
+		return basic_read_file_into(fpath, out);
+	} else {
+		std::string bytes;
+		if (!read_file_into(fpath, bytes)) {
+			return false;
+		}
+
+		using c_t = typename String::value_type;
+		out.resize(bytes.size());
+		std::transform(bytes.begin(), bytes.end(), out.begin(),
+				[](char c) { return c_t(uint8_t(c)); });
+		return true;
+	}
+}
+
+// Opens the text file as-is (without parsing) and stores it in out.
+// Fastest option.
+inline bool open_text_file_raw(
+		const std::filesystem::path& fpath, std::string& out) {
+	return read_file_into(fpath, out);
+}
+// Opens the text file as-is (without parsing) and stores it in out.
+// Fastest option.
+// Each byte is widened to one wchar_t.
+inline bool wopen_text_file_raw(
+		const std::filesystem::path& fpath, std::wstring& out) {
+	return open_text_file_raw<std::wifstream>(fpath, out);
+}
+// Views the mapped file as-is (without parsing). No copies are made.
+inline bool open_text_file_raw(
+		const mapped_file& file, std::string_view& out) {
+	if (!file.is_open()) {
+		return false;
+	}
+
+	out = file.view();
+	return true;
+}
+
+// Opens binary file and stores bytes in vector.
+inline bool open_binary_file(
+		const std::filesystem::path& f, std::vector<uint8_t>& out) {
+	return read_file_into(f, out);
+}
+
+
+struct write_file_options {
+	// Writes are gathered until this many bytes are pending.
+	size_t buffer_size = file_chunk_size;
+
+	// Reserves disk space up-front, when supported. The file is trimmed to
+	// what was written when closing.
+	uint64_t preallocate = 0;
+
+	// Writes to a temporary file next to the destination, which replaces
+	// it once closed. Readers never see a partial file.
+	bool atomic = false;
+
+	// Appends to the file instead of truncating it. Ignored when atomic.
+	bool append = false;
+};
+
+// A buffered, move-only file writer. Closing flushes the data, and commits
+// the file when writing atomically. Atomic writes which failed are discarded.
+struct file_writer {
+	file_writer() = default;
+	file_writer(const std::filesystem::path& fpath,
+			const write_file_options& opts = {}) {
+		open(fpath, opts);
+	}
+	~file_writer() {
+		close();
+	}
+
+	file_writer(const file_writer&) = delete;
+	file_writer& operator=(const file_writer&) = delete;
+
+	file_writer(file_writer&& other) noexcept {
+		swap(other);
+	}
+	file_writer& operator=(file_writer&& other) noexcept {
+		if (this != &other) {
+			close();
+			swap(other);
+		}
+		return *this;
+	}
+
+	bool open(const std::filesystem::path& fpath,
+			const write_file_options& opts = {}) {
+		close();
+
+		_path = fpath;
+		_write_path = fpath;
+		bool append = opts.append && !opts.atomic;
+
+#if defined(FEA_POSIX)
+		if (opts.atomic) {
+			// A new temporary file, which no one else can be using.
+			for (size_t attempt = 0; attempt < max_temp_attempts; ++attempt) {
+				_write_path = temp_path(fpath, attempt);
+				_fd = ::open(_write_path.c_str(),
+						O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+				if (_fd != -1 || errno != EEXIST) {
+					break;
+				}
+			}
+
+			// Keep the destination's permissions.
+			struct stat st {};
+			if (_fd != -1 && ::stat(fpath.c_str(), &st) == 0) {
+				fchmod(_fd, st.st_mode & 07777);
+			}
+		} else {
+			int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+			flags |= append ? O_APPEND : O_TRUNC;
+			_fd = ::open(_write_path.c_str(), flags, 0666);
+		}
+
+		if (_fd == -1) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					_write_path.string().c_str());
+			return false;
+		}
+
+		if (append) {
+			struct stat st {};
+			if (fstat(_fd, &st) == 0) {
+				_pos = uint64_t(st.st_size);
+			}
+		}
+
+#if defined(__linux__)
+		if (opts.preallocate != 0
+				&& posix_fallocate(_fd, off_t(_pos), off_t(opts.preallocate))
+						== 0) {
+			_preallocated = true;
+		}
+#endif
+#else
+		std::error_code ec;
+		if (opts.atomic) {
+			// Streams can't open exclusively, pick a name which isn't taken.
+			for (size_t attempt = 0; attempt < max_temp_attempts; ++attempt) {
+				_write_path = temp_path(fpath, attempt);
+				if (!std::filesystem::exists(_write_path, ec)) {
+					break;
+				}
+			}
+		}
+
+		std::ios::openmode mode = std::ios::binary;
+		mode |= append ? std::ios::app : std::ios::trunc;
+		_ofs.open(_write_path, mode);
+		if (!_ofs.is_open()) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					_write_path.string().c_str());
+			return false;
+		}
+
+		if (opts.atomic && std::filesystem::exists(fpath, ec)) {
+			std::filesystem::permissions(_write_path,
+					std::filesystem::status(fpath, ec).permissions(), ec);
+		}
+#endif
+
+		_buffer_size = std::max(opts.buffer_size, size_t(1));
+		_buffer.reserve(_buffer_size);
+		_atomic = opts.atomic;
+		_open = true;
+		_failed = false;
+		return true;
+	}
+
+	[[nodiscard]] bool is_open() const {
+		return _open;
+	}
+
+	// Did a write fail.
+	[[nodiscard]] bool failed() const {
+		return _failed;
+	}
+
+	bool write(const void* data, size_t size) {
+		if (!_open || _failed) {
+			return false;
+		}
+
+		const char* first = static_cast<const char*>(data);
+		if (_buffer.size() + size <= _buffer_size) {
+			_buffer.insert(_buffer.end(), first, first + size);
+			return true;
+		}
+
+		// Too big, send the pending bytes and the new ones together.
+		return write_through(first, size);
+	}
+
+	bool write(std::string_view str) {
+		return write(str.data(), str.size());
+	}
+
+	// Writes the line and a linefeed.
+	bool write_line(std::string_view line, std::string_view linefeed = "\n") {
+		return write(line) && write(linefeed);
+	}
+
+	// Writes each line followed by a linefeed.
+	// Lines must be convertible to std::string_view.
+	template <class Range>
+	bool write_lines(const Range& lines, std::string_view linefeed = "\n") {
+		for (const auto& line : lines) {
+			if (!write_line(std::string_view{ line }, linefeed)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Sends the buffered bytes to the OS.
+	bool flush() {
+		if (!_open || _failed) {
+			return false;
+		}
+		return write_through(nullptr, 0);
+	}
+
+	// Flushes and closes the file. When atomic, replaces the destination.
+	// On failure, the destination is left untouched.
+	bool close() {
+		if (!_open) {
+			return false;
+		}
+
+		bool ret = flush();
+
+#if defined(FEA_POSIX)
+		if (ret && _preallocated && ftruncate(_fd, off_t(_pos)) != 0) {
+			ret = false;
+		}
+		if (ret && _atomic && fsync(_fd) != 0) {
+			ret = false;
+		}
+		if (::close(_fd) != 0) {
+			ret = false;
+		}
+		_fd = -1;
+		_preallocated = false;
+#else
+		_ofs.close();
+		ret = ret && !_ofs.fail();
+		_ofs = {};
+#endif
+
+		if (_atomic) {
+			std::error_code ec;
+			if (ret) {
+				std::filesystem::rename(_write_path, _path, ec);
+				ret = !ec;
+			}
+			if (!ret) {
+				std::filesystem::remove(_write_path, ec);
+			}
+		}
+
+		if (!ret) {
+			fprintf(stderr, "Couldn't write file : %s\n",
+					_path.string().c_str());
+		}
+
+		_buffer = {};
+		_pos = 0;
+		_atomic = false;
+		_open = false;
+		_failed = false;
+		return ret;
+	}
+
+	void swap(file_writer& other) noexcept {
+		std::swap(_path, other._path);
+		std::swap(_write_path, other._write_path);
+		std::swap(_buffer, other._buffer);
+		std::swap(_buffer_size, other._buffer_size);
+		std::swap(_pos, other._pos);
+		std::swap(_atomic, other._atomic);
+		std::swap(_open, other._open);
+		std::swap(_failed, other._failed);
+#if defined(FEA_POSIX)
+		std::swap(_fd, other._fd);
+		std::swap(_preallocated, other._preallocated);
+#else
+		std::swap(_ofs, other._ofs);
+#endif
+	}
+
+private:
+	static constexpr size_t max_temp_attempts = 100;
+
+	// Returns a temporary file path next to fpath, unique to this process,
+	// call and attempt.
+	static std::filesystem::path temp_path(
+			const std::filesystem::path& fpath, size_t attempt) {
+		static std::atomic<uint64_t> counter{ 0 };
+		const uint64_t seed = uint64_t(std::chrono::steady_clock::now()
+												   .time_since_epoch()
+												   .count())
+				^ (uint64_t(std::hash<std::thread::id>{}(
+						   std::this_thread::get_id()))
+						<< 1)
+				^ (counter.fetch_add(1) * 0x9E3779B97F4A7C15ull);
+
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%016llx.%zu.tmp",
+				static_cast<unsigned long long>(seed), attempt);
+		std::filesystem::path ret = fpath;
+		ret += suffix;
+		return ret;
+	}
+
+	// Writes the buffer followed by data, then clears the buffer.
+	bool write_through(const char* data, size_t size) {
+#if defined(FEA_POSIX)
+		iovec iov[2];
+		iov[0].iov_base = _buffer.data();
+		iov[0].iov_len = _buffer.size();
+		iov[1].iov_base = const_cast<char*>(data);
+		iov[1].iov_len = size;
+
+		iovec* first = iov;
+		int count = 2;
+		while (count > 0) {
+			if (first->iov_len == 0) {
+				++first;
+				--count;
+				continue;
+			}
+
+			ssize_t written = writev(_fd, first, count);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				_failed = true;
+				return false;
+			}
+
+			// Partial write, skip what went through.
+			_pos += uint64_t(written);
+			size_t remaining = size_t(written);
+			while (count > 0 && remaining >= first->iov_len) {
+				remaining -= first->iov_len;
+				++first;
+				--count;
+			}
+			if (count > 0) {
+				char* base = static_cast<char*>(first->iov_base);
+				first->iov_base = base + remaining;
+				first->iov_len -= remaining;
+			}
+		}
+#else
+		_ofs.write(_buffer.data(), std::streamsize(_buffer.size()));
+		_ofs.write(data, std::streamsize(size));
+		if (!_ofs) {
+			_failed = true;
+			return false;
+		}
+		_pos += _buffer.size() + size;
+#endif
+
+		_buffer.clear();
+		return true;
+	}
+
+	std::filesystem::path _path;
+	std::filesystem::path _write_path;
+	std::vector<char> _buffer;
+	size_t _buffer_size{ file_chunk_size };
+	uint64_t _pos{ 0 };
+	bool _atomic{ false };
+	bool _open{ false };
+	bool _failed{ false };
+
+#if defined(FEA_POSIX)
+	int _fd{ -1 };
+	bool _preallocated{ false };
+#else
+	std::ofstream _ofs;
+#endif
+};
+
+// Writes the text to a file.
+inline bool write_text_file(const std::filesystem::path& fpath,
+		std::string_view text, const write_file_options& opts = {}) {
+	file_writer writer{ fpath, opts };
+	writer.write(text);
+	return writer.close();
+}
+
+// Writes every line to a file, followed by a linefeed.
+// Lines must be convertible to std::string_view.
+template <class Range,
+		class = std::enable_if_t<
+				!std::is_convertible_v<const Range&, std::string_view>>>
+bool write_text_file(const std::filesystem::path& fpath, const Range& lines,
+		const write_file_options& opts = {}) {
+	file_writer writer{ fpath, opts };
+	writer.write_lines(lines);
+	return writer.close();
+}
+
+// Writes the bytes to a file.
+inline bool write_binary_file(const std::filesystem::path& fpath,
+		const void* data, size_t size, const write_file_options& opts = {}) {
+	file_writer writer{ fpath, opts };
+	writer.write(data, size);
+	return writer.close();
+}
+
+// Writes the bytes to a file.
+inline bool write_binary_file(const std::filesystem::path& fpath,
+		const std::vector<uint8_t>& bytes,
+		const write_file_options& opts = {}) {
+	return write_binary_file(fpath, bytes.data(), bytes.size(), opts);
+}
+
+
+// Stores where every line of a text starts, for random access.
+// Offsets are 32 bits when the text is small enough.
+// The index can be saved next to the file and reloaded, to skip the scan.
+// Indexes of mapped files remember the file stamp, so reopening an unchanged
+// file doesn't read it.
+struct line_index {
+	line_index() = default;
+	explicit line_index(std::string_view text) {
+		build(text);
+	}
+	explicit line_index(const mapped_file& file) {
+		build(file);
+	}
+
+	// Scans the text for linefeeds. Lines follow read_text_file rules.
+	void build(std::string_view text) {
+		_offsets32 = {};
+		_offsets64 = {};
+		_stamp = {};
+		_text_size = text.size();
+		_text_hash = hash_text(text);
+		_wide = text.size() > size_t(std::numeric_limits<uint32_t>::max());
+
+		size_t pos = 0;
+		while (pos < text.size()) {
+			push_back(pos);
+
+			const void* lf
+					= std::memchr(text.data() + pos, '\n', text.size() - pos);
+			if (lf == nullptr) {
+				break;
+			}
+			pos = size_t(static_cast<const char*>(lf) - text.data()) + 1;
+		}
+	}
+	void build(const mapped_file& file) {
+		build(file.view());
+		_stamp = file.stamp();
+	}
+
+	// Number of lines.
+	[[nodiscard]] size_t size() const {
+		return _wide ? _offsets64.size() : _offsets32.size();
+	}
+
+	[[nodiscard]] bool empty() const {
+		return size() == 0;
+	}
+
+	// Size of the indexed text, in bytes.
+	[[nodiscard]] size_t text_size() const {
+		return size_t(_text_size);
+	}
+
+	// Is the text the one that was indexed.
+	// Only checks the size and a hash of its beginning and end.
+	[[nodiscard]] bool matches(std::string_view text) const {
+		return text.size() == _text_size && hash_text(text) == _text_hash;
+	}
+
+	// Is the file the one that was indexed. Compares the file stamps, then
+	// the sampled hash. Doesn't read the whole file.
+	[[nodiscard]] bool matches(const mapped_file& file) const {
+		return _stamp != file_stamp{} && _stamp == file.stamp()
+				&& matches(file.view());
+	}
+
+	// The stamp of the indexed file, empty when built from a string.
+	[[nodiscard]] const file_stamp& stamp() const {
+		return _stamp;
+	}
+
+	// Byte offset of the beginning of a line.
+	[[nodiscard]] size_t offset(size_t line_idx) const {
+		assert(line_idx < size());
+		return _wide ? size_t(_offsets64[line_idx])
+					 : size_t(_offsets32[line_idx]);
+	}
+
+	// Returns line line_idx of the text, without linefeeds.
+	[[nodiscard]] std::string_view line(
+			std::string_view text, size_t line_idx) const {
+		return lines(text, line_idx, line_idx + 1);
+	}
+	[[nodiscard]] std::string_view line(
+			const mapped_file& file, size_t line_idx) const {
+		return line(file.view(), line_idx);
+	}
+
+	// Returns lines [first, last) of the text. The linefeeds in between are
+	// kept, the last one is removed.
+	[[nodiscard]] std::string_view lines(
+			std::string_view text, size_t first, size_t last) const {
+		assert(text.size() == _text_size);
+		assert(first <= last && last <= size());
+		if (first == last) {
+			return {};
+		}
+
+		size_t beg = offset(first);
+		size_t end = last == size() ? text.size() : offset(last);
+		std::string_view ret = text.substr(beg, end - beg);
+		if (ret.size() > 0 && ret.back() == '\n') {
+			ret.remove_suffix(1);
+		}
+		if (ret.size() > 0 && ret.back() == '\r') {
+			ret.remove_suffix(1);
+		}
+		return ret;
+	}
+	[[nodiscard]] std::string_view lines(
+			const mapped_file& file, size_t first, size_t last) const {
+		return lines(file.view(), first, last);
+	}
+
+	// Writes the index in a sidecar file.
+	bool save(const std::filesystem::path& fpath) const {
+		std::ofstream ofs{ fpath, std::ios::binary | std::ios::trunc };
+		if (!ofs.is_open()) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		uint64_t count = size();
+		uint8_t wide = _wide ? 1 : 0;
+		write_pod(ofs, magic);
+		write_pod(ofs, version);
+		write_pod(ofs, _text_size);
+		write_pod(ofs, _text_hash);
+		write_pod(ofs, _stamp);
+		write_pod(ofs, count);
+		write_pod(ofs, wide);
+
+		if (_wide) {
+			ofs.write(reinterpret_cast<const char*>(_offsets64.data()),
+					std::streamsize(count * sizeof(uint64_t)));
+		} else {
+			ofs.write(reinterpret_cast<const char*>(_offsets32.data()),
+					std::streamsize(count * sizeof(uint32_t)));
+		}
+		return bool(ofs);
+	}
+
+	// Reads an index written with save.
+	// Check it still matches your text before using it.
+	bool load(const std::filesystem::path& fpath) {
+		*this = {};
+
+		std::ifstream ifs{ fpath, std::ios::binary | std::ios::ate };
+		if (!ifs.is_open()) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+		const uint64_t file_size = uint64_t(ifs.tellg());
+		ifs.seekg(0, ifs.beg);
+
+		uint32_t file_magic = 0;
+		uint32_t file_version = 0;
+		uint64_t count = 0;
+		uint8_t wide = 0;
+		read_pod(ifs, file_magic);
+		read_pod(ifs, file_version);
+		read_pod(ifs, _text_size);
+		read_pod(ifs, _text_hash);
+		read_pod(ifs, _stamp);
+		read_pod(ifs, count);
+		read_pod(ifs, wide);
+
+		// The offsets must fill the rest of the file, don't trust count
+		// before allocating.
+		const uint64_t unit = wide != 0 ? sizeof(uint64_t) : sizeof(uint32_t);
+		if (!ifs || file_magic != magic || file_version != version
+				|| count > _text_size || file_size < header_size
+				|| count != (file_size - header_size) / unit
+				|| (file_size - header_size) % unit != 0) {
+			fprintf(stderr, "Invalid line index : %s\n",
+					fpath.string().c_str());
+			*this = {};
+			return false;
+		}
+
+		_wide = wide != 0;
+		if (_wide) {
+			_offsets64.resize(size_t(count));
+			ifs.read(reinterpret_cast<char*>(_offsets64.data()),
+					std::streamsize(count * sizeof(uint64_t)));
+		} else {
+			_offsets32.resize(size_t(count));
+			ifs.read(reinterpret_cast<char*>(_offsets32.data()),
+					std::streamsize(count * sizeof(uint32_t)));
+		}
+
+		if (!ifs || !offsets_valid()) {
+			fprintf(stderr, "Invalid line index : %s\n",
+					fpath.string().c_str());
+			*this = {};
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static constexpr uint32_t magic = 0x58444c46; // "FLDX"
+	static constexpr uint32_t version = 3;
+	// Magic, version, text size, hash, stamp, count and wide flag.
+	static constexpr uint64_t header_size
+			= 4 + 4 + 8 + 8 + sizeof(file_stamp) + 8 + 1;
+
+	// FNV-1a of the first and last few KBs.
+	static uint64_t hash_text(std::string_view text) {
+		constexpr size_t sample_size = 4096;
+		uint64_t ret = 14695981039346656037ull;
+		auto hash = [&](std::string_view sample) {
+			for (char c : sample) {
+				ret ^= uint8_t(c);
+				ret *= 1099511628211ull;
+			}
+		};
+
+		if (text.size() <= sample_size * 2) {
+			hash(text);
+		} else {
+			hash(text.substr(0, sample_size));
+			hash(text.substr(text.size() - sample_size));
+		}
+		return ret;
+	}
+
+	// Offsets must be sorted and inside the text.
+	[[nodiscard]] bool offsets_valid() const {
+		auto valid = [&](const auto& offsets) {
+			for (size_t i = 0; i < offsets.size(); ++i) {
+				if (offsets[i] > _text_size
+						|| (i > 0 && offsets[i] < offsets[i - 1])) {
+					return false;
+				}
+			}
+			return true;
+		};
+		return _wide ? valid(_offsets64) : valid(_offsets32);
+	}
+
+	template <class T>
+	static void write_pod(std::ofstream& ofs, const T& t) {
+		ofs.write(reinterpret_cast<const char*>(&t), sizeof(T));
+	}
+
+	template <class T>
+	static void read_pod(std::ifstream& ifs, T& t) {
+		ifs.read(reinterpret_cast<char*>(&t), sizeof(T));
+	}
+
+	void push_back(size_t offset) {
+		if (_wide) {
+			_offsets64.push_back(uint64_t(offset));
+		} else {
+			_offsets32.push_back(uint32_t(offset));
+		}
+	}
+
+	std::vector<uint32_t> _offsets32;
+	std::vector<uint64_t> _offsets64;
+	uint64_t _text_size{ 0 };
+	uint64_t _text_hash{ 0 };
+	file_stamp _stamp{};
+	bool _wide{ false };
+};
+
+// Loads the line index from its sidecar file if the mapped file is unchanged
+// since, comparing file stamps. Otherwise, indexes the file and writes the
+// sidecar.
+inline bool open_line_index(const mapped_file& file,
+		const std::filesystem::path& sidecar_path, line_index& out) {
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::error_code ec;
+	if (std::filesystem::exists(sidecar_path, ec) && out.load(sidecar_path)
+			&& out.matches(file)) {
+		return true;
+	}
+
+	out.build(file);
+	return out.save(sidecar_path);
+}
+
+
+enum class text_encoding {
+	utf32be,
+	utf32le,
+	utf16be,
+	utf16le,
+	utf8,
+	count,
+};
+
+// Loads blocks of From units from raw bytes and converts them to To while
+// they are in cache. Appends to out, which is sized once for the whole input.
+template <class From, class To, class String>
+bool decode_units(std::string_view bytes, bool big_endian, String& out) {
+	using in_char = typename From::char_type;
+	constexpr size_t block_size = 4096 / sizeof(in_char);
+	in_char units[block_size];
+	transcoder<From, To> tc;
+
+	const size_t count = bytes.size() / sizeof(in_char);
+	out.reserve(out.size() + max_transcoded_size<From, To>(count));
+	for (size_t i = 0; i < count; i += block_size) {
+		const size_t n = std::min(block_size, count - i);
+		load_units(bytes.data() + i * sizeof(in_char), n, big_endian, units);
+		if (tc.feed(std::basic_string_view<in_char>{ units, n }, out).error
+				!= transcode_error::none) {
+			return false;
+		}
+	}
+	return tc.flush() == transcode_error::none;
+}
+
+// Decodes text stored in encoding to To, in a single pass.
+// Returns false if it isn't valid in that encoding, and clears out.
+template <class To, class String>
+bool basic_decode_text(
+		std::string_view input_str, text_encoding encoding, String& out) {
+	using utf32 = utf32_codec<char32_t>;
+	out.clear();
+
+	bool ret = false;
+	switch (encoding) {
+	case text_encoding::utf32be:
+	case text_encoding::utf32le: {
+		if (input_str.size() % 4 != 0) {
+			return false;
+		}
+
+		const bool big_endian = encoding == text_encoding::utf32be;
+		if constexpr (std::is_same_v<To, utf32>) {
+			// Swaps and validates in one pass, straight into the output.
+			out.resize(input_str.size() / 4);
+			ret = load_and_validate<utf32>(input_str, big_endian, out.data())
+						  .valid();
+		} else {
+			ret = decode_units<utf32, To>(input_str, big_endian, out);
+		}
+	} break;
+	case text_encoding::utf16be:
+	case text_encoding::utf16le: {
+		if (input_str.size() % 2 != 0) {
+			return false;
+		}
+
+		const bool big_endian = encoding == text_encoding::utf16be;
+		ret = decode_units<utf16_codec<char16_t>, To>(
+				input_str, big_endian, out);
+	} break;
+	case text_encoding::utf8: {
+		ret = transcode_into<utf8_codec, To>(input_str, out).error
+				== transcode_error::none;
+	} break;
+	default: {
+	} break;
+	}
+
+	if (!ret) {
+		out.clear();
+	}
+	return ret;
+}
 
-	// else
-	// 5. If the index modulo 4 is 0 and the character is greater than
-	// 0x7F, the string is UTF-32LE. This is because the range of
-	// UTF-32 only goes up to 0x7FFFFFFF, meaning approximately 22%
-	// of the characters that can be represented will validate that
-	// the string is not big endian; including a BOM.
+// Decodes the text to utf32. Returns false if it isn't valid in that encoding.
+inline bool reconstruct_text_file(std::string_view input_str,
+		text_encoding encoding, std::u32string& output_str) {
+	return basic_decode_text<utf32_codec<char32_t>>(
+			input_str, encoding, output_str);
+}
+
+// Based on :
+// https://www.codeproject.com/Tips/672470/Simple-Character-Encoding-Detection
+// Gathers null alignment and utf8 validity in a single pass.
+// Provide a sample_size to only look at the beginning of the text. The scan
+// also stops as soon as the result can't change.
+inline text_encoding detect_encoding(std::string_view str,
+		size_t sample_size = std::numeric_limits<size_t>::max()) {
+	const bool sampled = sample_size < str.size();
+	if (sampled) {
+		str = str.substr(0, sample_size);
+	}
+
+	// Which byte lanes (index % 4) hold nulls, and which hold values.
+	bool lane_null[4]{};
+	bool lane_value[4]{};
+	bool double_null = false;
+	bool prev_null = false;
+
+	// utf8 validation state. The next byte must be in [lo, hi].
+	bool utf8_valid = true;
+	size_t utf8_needed = 0;
+	uint8_t utf8_lo = 0x80;
+	uint8_t utf8_hi = 0xBF;
+
+	auto scan = [&](size_t idx, uint8_t c) {
+		const bool is_null = c == 0;
+		lane_null[idx % 4] |= is_null;
+		lane_value[idx % 4] |= !is_null;
+		double_null |= is_null && prev_null;
+		prev_null = is_null;
+
+		if (utf8_needed != 0) {
+			if (c < utf8_lo || c > utf8_hi) {
+				utf8_valid = false;
+				utf8_needed = 0;
+				return;
+			}
+			--utf8_needed;
+			utf8_lo = 0x80;
+			utf8_hi = 0xBF;
+			return;
+		}
+
+		if (c < 0x80) {
+			return;
+		}
+
+		// Overlongs, surrogates and code points over U+10FFFF are invalid.
+		if (c >= 0xC2 && c <= 0xDF) {
+			utf8_needed = 1;
+		} else if (c >= 0xE0 && c <= 0xEF) {
+			utf8_needed = 2;
+			utf8_lo = c == 0xE0 ? 0xA0 : 0x80;
+			utf8_hi = c == 0xED ? 0x9F : 0xBF;
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			utf8_needed = 3;
+			utf8_lo = c == 0xF0 ? 0x90 : 0x80;
+			utf8_hi = c == 0xF4 ? 0x8F : 0xBF;
+		} else {
+			utf8_valid = false;
+		}
+	};
+
+	// Double nulls with values in lanes 0 and 3 can't be utf16 or utf32.
+	auto undecidable = [&]() {
+		return double_null && lane_value[0] && lane_value[3];
+	};
+
+	constexpr uint64_t ones = 0x0101010101010101ull;
+	constexpr uint64_t highs = 0x8080808080808080ull;
+
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(str.data());
+	size_t i = 0;
+	for (; i + 8 <= str.size(); i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+
+		// Blocks of plain ascii are the common case, skip them whole.
+		const bool has_null = ((word - ones) & ~word & highs) != 0;
+		const bool has_high = (word & highs) != 0;
+		if (!has_null && !has_high && utf8_needed == 0) {
+			lane_value[0] = lane_value[1] = true;
+			lane_value[2] = lane_value[3] = true;
+			prev_null = false;
+			continue;
+		}
+
+		for (size_t j = i; j < i + 8; ++j) {
+			scan(j, data[j]);
+		}
+
+		if (undecidable()) {
+			return text_encoding::count;
+		}
+	}
+	for (; i < str.size(); ++i) {
+		scan(i, data[i]);
+	}
+
+	// A sample may cut a multi-byte sequence.
+	if (utf8_needed != 0 && !sampled) {
+		utf8_valid = false;
+	}
+
+	// 1. If a string doesn't contain nulls, its UTF-8
+	const bool has_null = lane_null[0] || lane_null[1] || lane_null[2]
+			|| lane_null[3];
+	if (!has_null) {
+		return utf8_valid ? text_encoding::utf8 : text_encoding::count;
+	}
+
+	// 2. If a string doesn't contain double nulls, it's UTF-16
+	if (!double_null) {
+		// 3. If the nulls are on odd numbered indices, it's UTF-16LE
+		if (lane_null[1] || lane_null[3]) {
+			return text_encoding::utf16le;
+		}
+
+		// 4. The string defaults to UTF-16BE
+		return text_encoding::utf16be;
+	}
+
+	// 5. UTF-32 never uses the high byte, it's always null.
+	if (sampled || str.size() % 4 == 0) {
+		if (!lane_value[3]) {
+			return text_encoding::utf32le;
+		}
+		if (!lane_value[0]) {
+			return text_encoding::utf32be;
+		}
+	}
+
+	return text_encoding::count;
+}
+
+// Returns the encoding of the byte order mark starting the text, or count.
+// Writes the mark's size in bom_size.
+inline text_encoding detect_bom(std::string_view str, size_t& bom_size) {
+	// utf32le starts like utf16le, test it first.
+	constexpr std::string_view boms[] = {
+		std::string_view{ "\x00\x00\xFE\xFF", 4 }, // utf32be
+		std::string_view{ "\xFF\xFE\x00\x00", 4 }, // utf32le
+		std::string_view{ "\xFE\xFF", 2 }, // utf16be
+		std::string_view{ "\xFF\xFE", 2 }, // utf16le
+		std::string_view{ "\xEF\xBB\xBF", 3 }, // utf8
+	};
+
+	for (size_t i = 0; i < std::size(boms); ++i) {
+		if (str.substr(0, boms[i].size()) == boms[i]) {
+			bom_size = boms[i].size();
+			return text_encoding(i);
+		}
+	}
+
+	bom_size = 0;
+	return text_encoding::count;
+}
+
+struct decode_text_options {
+	// Used when the file has no byte order mark and detection fails.
+	// count reports an error.
+	text_encoding fallback = text_encoding::count;
+
+	// Detects the encoding from this many bytes at most.
+	size_t sample_size = std::numeric_limits<size_t>::max();
+};
+
+// Maps the file, picks its encoding from the byte order mark or detects it,
+// then decodes it once in out. Returns the encoding of the file, or count
+// on failure.
+template <class To, class String>
+text_encoding basic_decode_text_file(const std::filesystem::path& fpath,
+		String& out, const decode_text_options& opts = {}) {
+	out.clear();
+
+	mapped_file file;
+	if (!file.open(fpath, mapped_file_mode::read_only,
+				mapped_file_hint::sequential)) {
+		return text_encoding::count;
+	}
+
+	std::string_view bytes = file.view();
+	size_t bom_size = 0;
+	text_encoding enc = detect_bom(bytes, bom_size);
+	bytes.remove_prefix(bom_size);
+
+	if (enc == text_encoding::count) {
+		enc = bytes.empty() ? text_encoding::utf8
+							: detect_encoding(bytes, opts.sample_size);
+	}
+	if (enc == text_encoding::count) {
+		enc = opts.fallback;
+	}
+
+	if (!basic_decode_text<To>(bytes, enc, out)) {
+		fprintf(stderr, "Couldn't decode file : %s\n",
+				fpath.string().c_str());
+		return text_encoding::count;
+	}
+	return enc;
+}
+
+// Decodes the file to utf32. Returns the encoding of the file, or count on
+// failure.
+inline text_encoding decode_text_file(const std::filesystem::path& fpath,
+		std::u32string& out, const decode_text_options& opts = {}) {
+	return basic_decode_text_file<utf32_codec<char32_t>>(fpath, out, opts);
+}
 
-	// else
-	// 6. The string defaults to UTF-32BE
+// Decodes the file to utf8. Returns the encoding of the file, or count on
+// failure.
+inline text_encoding decode_text_file(const std::filesystem::path& fpath,
+		std::string& out, const decode_text_options& opts = {}) {
+	return basic_decode_text_file<utf8_codec>(fpath, out, opts);
 }
 
 inline std::u32string open_text_file_with_bom(std::ifstream& src) {
@@ -0,0 +1,377 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include "fea_utils/platform.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+
+#if defined(FEA_WINDOWS)
+#include <windows.h>
+#elif defined(FEA_POSIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <fstream>
+#include <vector>
+#endif
+
+namespace fea {
+enum class mapped_file_mode : unsigned {
+	// Pages are shared with the file, writing is not allowed.
+	read_only,
+	// Pages are private, writes never reach the file.
+	copy_on_write,
+	count,
+};
+
+// Access pattern hints, forwarded to the OS (madvise on posix).
+enum class mapped_file_hint : unsigned {
+	normal,
+	sequential,
+	random,
+	count,
+};
+
+// Identifies the version of a file that was opened. A file that is
+// rewritten or replaced gets a different stamp.
+struct file_stamp {
+	uint64_t size = 0;
+	// Last write time, in platform ticks.
+	int64_t mtime = 0;
+	// Device (or volume) and file id, 0 where the platform has none.
+	uint64_t device = 0;
+	uint64_t id = 0;
+
+	friend bool operator==(const file_stamp& lhs, const file_stamp& rhs) {
+		return lhs.size == rhs.size && lhs.mtime == rhs.mtime
+				&& lhs.device == rhs.device && lhs.id == rhs.id;
+	}
+	friend bool operator!=(const file_stamp& lhs, const file_stamp& rhs) {
+		return !(lhs == rhs);
+	}
+};
+
+// A memory-mapped view of a file. The contents aren't copied, pages are
+// loaded on first touch. Move-only, unmaps on destruction.
+// Platforms without mapping support read the file in a buffer instead.
+struct mapped_file {
+	mapped_file() = default;
+	mapped_file(const std::filesystem::path& fpath,
+			mapped_file_mode mode = mapped_file_mode::read_only,
+			mapped_file_hint hint = mapped_file_hint::normal) {
+		open(fpath, mode, hint);
+	}
+	~mapped_file() {
+		close();
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	mapped_file(mapped_file&& other) noexcept {
+		swap(other);
+	}
+	mapped_file& operator=(mapped_file&& other) noexcept {
+		if (this != &other) {
+			close();
+			swap(other);
+		}
+		return *this;
+	}
+
+	// Maps the file. Returns false and prints an error on failure.
+	bool open(const std::filesystem::path& fpath,
+			mapped_file_mode mode = mapped_file_mode::read_only,
+			mapped_file_hint hint = mapped_file_hint::normal) {
+		close();
+
+#if defined(FEA_WINDOWS)
+		DWORD flags = FILE_ATTRIBUTE_NORMAL;
+		if (hint == mapped_file_hint::sequential) {
+			flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+		} else if (hint == mapped_file_hint::random) {
+			flags |= FILE_FLAG_RANDOM_ACCESS;
+		}
+
+		HANDLE file = CreateFileW(fpath.c_str(), GENERIC_READ,
+				FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		BY_HANDLE_FILE_INFORMATION info{};
+		if (!GetFileInformationByHandle(file, &info)) {
+			CloseHandle(file);
+			fprintf(stderr, "Couldn't stat file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		_mode = mode;
+		_size = size_t((uint64_t(info.nFileSizeHigh) << 32)
+				| info.nFileSizeLow);
+		_stamp.size = uint64_t(_size);
+		_stamp.mtime = int64_t((uint64_t(info.ftLastWriteTime.dwHighDateTime)
+										<< 32)
+				| info.ftLastWriteTime.dwLowDateTime);
+		_stamp.device = info.dwVolumeSerialNumber;
+		_stamp.id = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		_open = true;
+		if (_size == 0) {
+			// Can't map empty files, but they are valid.
+			CloseHandle(file);
+			return true;
+		}
+
+		DWORD protect = mode == mapped_file_mode::copy_on_write
+				? PAGE_WRITECOPY
+				: PAGE_READONLY;
+		HANDLE mapping
+				= CreateFileMappingW(file, nullptr, protect, 0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr) {
+			close();
+			fprintf(stderr, "Couldn't map file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		DWORD access = mode == mapped_file_mode::copy_on_write
+				? FILE_MAP_COPY
+				: FILE_MAP_READ;
+		void* ptr = MapViewOfFile(mapping, access, 0, 0, 0);
+		CloseHandle(mapping);
+		if (ptr == nullptr) {
+			close();
+			fprintf(stderr, "Couldn't map file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+		_data = static_cast<uint8_t*>(ptr);
+
+#elif defined(FEA_POSIX)
+		int fd = ::open(fpath.c_str(), O_RDONLY);
+		if (fd == -1) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		struct stat st {};
+		if (fstat(fd, &st) == -1) {
+			::close(fd);
+			fprintf(stderr, "Couldn't stat file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		_mode = mode;
+		_size = size_t(st.st_size);
+		_stamp.size = uint64_t(_size);
+#if defined(__APPLE__)
+		_stamp.mtime = int64_t(st.st_mtimespec.tv_sec) * 1'000'000'000
+				+ st.st_mtimespec.tv_nsec;
+#else
+		_stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1'000'000'000
+				+ st.st_mtim.tv_nsec;
+#endif
+		_stamp.device = uint64_t(st.st_dev);
+		_stamp.id = uint64_t(st.st_ino);
+		_open = true;
+		if (_size == 0) {
+			// Can't map empty files, but they are valid.
+			::close(fd);
+			return true;
+		}
+
+		int prot = PROT_READ;
+		int flags = MAP_SHARED;
+		if (mode == mapped_file_mode::copy_on_write) {
+			prot |= PROT_WRITE;
+			flags = MAP_PRIVATE;
+		}
+
+		void* ptr = mmap(nullptr, _size, prot, flags, fd, 0);
+		// The mapping keeps its own reference to the file.
+		::close(fd);
+		if (ptr == MAP_FAILED) {
+			close();
+			fprintf(stderr, "Couldn't map file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+		_data = static_cast<uint8_t*>(ptr);
+		advise(hint);
+
+#else
+		std::ifstream ifs{ fpath, std::ios::binary | std::ios::ate };
+		if (!ifs.is_open()) {
+			fprintf(stderr, "Couldn't open file : %s\n",
+					fpath.string().c_str());
+			return false;
+		}
+
+		_fallback = std::vector<uint8_t>(size_t(ifs.tellg()));
+		ifs.seekg(0, ifs.beg);
+		ifs.read(reinterpret_cast<char*>(_fallback.data()),
+				std::streamsize(_fallback.size()));
+
+		_mode = mode;
+		_size = _fallback.size();
+		_data = _fallback.empty() ? nullptr : _fallback.data();
+		_open = true;
+
+		std::error_code ec;
+		_stamp.size = uint64_t(_size);
+		_stamp.mtime = int64_t(std::filesystem::last_write_time(fpath, ec)
+									   .time_since_epoch()
+									   .count());
+		(void)hint;
+#endif
+		return true;
+	}
+
+	// Unmaps the file. Pointers and views previously returned are invalidated.
+	void close() {
+		if (_data != nullptr) {
+#if defined(FEA_WINDOWS)
+			UnmapViewOfFile(_data);
+#elif defined(FEA_POSIX)
+			munmap(_data, _size);
+#else
+			_fallback = {};
+#endif
+		}
+
+		_data = nullptr;
+		_size = 0;
+		_stamp = {};
+		_mode = mapped_file_mode::read_only;
+		_open = false;
+	}
+
+	// Change the access pattern hint of an opened file.
+	// Only supported on posix, windows takes the hint when opening.
+	void advise([[maybe_unused]] mapped_file_hint hint) {
+#if defined(FEA_POSIX) && !defined(FEA_WINDOWS)
+		if (_data == nullptr) {
+			return;
+		}
+
+		int advice = MADV_NORMAL;
+		if (hint == mapped_file_hint::sequential) {
+			advice = MADV_SEQUENTIAL;
+		} else if (hint == mapped_file_hint::random) {
+			advice = MADV_RANDOM;
+		}
+		madvise(_data, _size, advice);
+#endif
+	}
+
+	[[nodiscard]] bool is_open() const {
+		return _open;
+	}
+
+	[[nodiscard]] mapped_file_mode mode() const {
+		return _mode;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return _size;
+	}
+
+	[[nodiscard]] bool empty() const {
+		return _size == 0;
+	}
+
+	// The size, write time and id of the file when it was opened.
+	[[nodiscard]] const file_stamp& stamp() const {
+		return _stamp;
+	}
+
+	[[nodiscard]] const uint8_t* data() const {
+		return _data;
+	}
+
+	// Only writeable when opened as copy_on_write.
+	[[nodiscard]] uint8_t* data() {
+		return _data;
+	}
+
+	[[nodiscard]] const uint8_t* begin() const {
+		return _data;
+	}
+
+	[[nodiscard]] const uint8_t* end() const {
+		return _data + _size;
+	}
+
+	// The file contents as chars.
+	[[nodiscard]] std::string_view view() const {
+		if (_data == nullptr) {
+			return {};
+		}
+		return { reinterpret_cast<const char*>(_data), _size };
+	}
+
+	void swap(mapped_file& other) noexcept {
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+		std::swap(_stamp, other._stamp);
+		std::swap(_mode, other._mode);
+		std::swap(_open, other._open);
+#if !defined(FEA_WINDOWS) && !defined(FEA_POSIX)
+		std::swap(_fallback, other._fallback);
+#endif
+	}
+
+private:
+	uint8_t* _data{ nullptr };
+	size_t _size{ 0 };
+	file_stamp _stamp{};
+	mapped_file_mode _mode{ mapped_file_mode::read_only };
+	bool _open{ false };
+
+#if !defined(FEA_WINDOWS) && !defined(FEA_POSIX)
+	std::vector<uint8_t> _fallback;
+#endif
+};
+} // namespace fea
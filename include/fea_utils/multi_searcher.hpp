@@ -0,0 +1,331 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include "fea_utils/char_set.hpp"
+#include "fea_utils/string.hpp"
+#include "fea_utils/unicode.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+namespace fea {
+struct multi_match {
+	// Index of the needle, in construction order.
+	size_t needle = 0;
+	// Where the match starts in the haystack.
+	size_t position = 0;
+};
+
+// Searches for many needles at once, in a single pass over the haystack.
+// Needles are compiled into an Aho-Corasick automaton, with every failure
+// transition resolved up-front, so each unit costs one table lookup.
+// Units are mapped to the classes of units which appear in needles, which
+// keeps the tables small. Outside of partial matches, the haystack is
+// skipped to the next unit which can start a needle, with a vectorized
+// char_set scan for byte strings.
+// Empty needles are ignored. Needles aren't stored, they can be destroyed
+// after construction.
+template <class CharT>
+struct basic_multi_searcher {
+	using view_type = std::basic_string_view<CharT>;
+
+	basic_multi_searcher() = default;
+	basic_multi_searcher(std::initializer_list<view_type> needles)
+			: basic_multi_searcher(needles.begin(), needles.end()) {
+	}
+
+	// Takes an iterator range of strings, string views or literals.
+	template <class FwdIt>
+	basic_multi_searcher(FwdIt first, FwdIt last) {
+		build_classes(first, last);
+
+		_delta.assign(_class_count, 0);
+		_needle_at.assign(1, none);
+		for (; first != last; ++first) {
+			insert(to_string_view(*first));
+		}
+		build_links();
+	}
+
+	// Number of needles given, including empty ones.
+	[[nodiscard]] size_t size() const {
+		return _lengths.size();
+	}
+
+	// Does any needle appear in str. Stops at the first match.
+	[[nodiscard]] bool contains_any(view_type str) const {
+		bool found = false;
+		scan(str, [&](uint32_t, size_t) {
+			found = true;
+			return false;
+		});
+		return found;
+	}
+
+	// Calls func for every match, including overlapping ones, in the order
+	// they end in str.
+	// Pass in void(size_t needle_idx, size_t position)
+	template <class Func>
+	void find_all(view_type str, Func&& func) const {
+		scan(str, [&](uint32_t state, size_t end) {
+			for_each_output(state, [&](size_t needle) {
+				func(needle, end - _lengths[needle]);
+			});
+			return true;
+		});
+	}
+
+	// Returns every match, including overlapping ones.
+	[[nodiscard]] std::vector<multi_match> find_all(view_type str) const {
+		std::vector<multi_match> ret;
+		find_all(str, [&](size_t needle, size_t position) {
+			ret.push_back(multi_match{ needle, position });
+		});
+		return ret;
+	}
+
+	// Returns the sorted indices of the needles which appear in str.
+	// Stops once every needle was found.
+	[[nodiscard]] std::vector<size_t> find_needles(view_type str) const {
+		std::vector<size_t> ret;
+		std::vector<bool> seen(_lengths.size(), false);
+		size_t remaining = _match_count;
+		scan(str, [&](uint32_t state, size_t) {
+			for_each_output(state, [&](size_t needle) {
+				if (!seen[needle]) {
+					seen[needle] = true;
+					ret.push_back(needle);
+					--remaining;
+				}
+			});
+			return remaining != 0;
+		});
+
+		std::sort(ret.begin(), ret.end());
+		return ret;
+	}
+
+private:
+	static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+	template <class FwdIt>
+	void build_classes(FwdIt first, FwdIt last) {
+		bool narrow_seen[256]{};
+		for (FwdIt it = first; it != last; ++it) {
+			for (CharT c : to_string_view(*it)) {
+				const uint32_t u = unit_value(c);
+				if (u < 256) {
+					narrow_seen[u] = true;
+				} else {
+					_wide.push_back(u);
+				}
+			}
+		}
+		std::sort(_wide.begin(), _wide.end());
+		_wide.erase(std::unique(_wide.begin(), _wide.end()), _wide.end());
+
+		// Class 0 is every unit which isn't in a needle.
+		_class_count = 1;
+		for (size_t i = 0; i < 256; ++i) {
+			if (narrow_seen[i]) {
+				_narrow[i] = _class_count++;
+			}
+		}
+		_wide_first = _class_count;
+		_class_count += uint32_t(_wide.size());
+	}
+
+	[[nodiscard]] uint32_t unit_class(CharT c) const {
+		const uint32_t u = unit_value(c);
+		if (u < 256) {
+			return _narrow[u];
+		}
+
+		auto it = std::lower_bound(_wide.begin(), _wide.end(), u);
+		if (it == _wide.end() || *it != u) {
+			return 0;
+		}
+		return _wide_first + uint32_t(it - _wide.begin());
+	}
+
+	void insert(view_type needle) {
+		const uint32_t idx = uint32_t(_lengths.size());
+		_lengths.push_back(needle.size());
+		_next_same.push_back(none);
+		if (needle.empty()) {
+			return;
+		}
+
+		uint32_t state = 0;
+		for (CharT c : needle) {
+			const size_t edge = state * size_t(_class_count) + unit_class(c);
+			if (_delta[edge] == 0) {
+				// The root is never a child, 0 means no edge yet.
+				_delta[edge] = uint32_t(_needle_at.size());
+				_delta.resize(_delta.size() + _class_count, 0);
+				_needle_at.push_back(none);
+			}
+			state = _delta[edge];
+		}
+
+		// Identical needles share their state, chained by index.
+		_next_same[idx] = _needle_at[state];
+		_needle_at[state] = idx;
+		++_match_count;
+	}
+
+	// Resolves failure transitions breadth first, turning the trie into a
+	// complete automaton.
+	void build_links() {
+		const size_t state_count = _needle_at.size();
+		std::vector<uint32_t> fail(state_count, 0);
+		_output_link.assign(state_count, 0);
+		_terminal.assign(state_count, false);
+
+		std::vector<uint32_t> queue;
+		queue.reserve(state_count);
+		_first_class.assign(_class_count, false);
+		for (uint32_t c = 0; c < _class_count; ++c) {
+			const uint32_t child = _delta[c];
+			if (child != 0) {
+				_first_class[c] = true;
+				queue.push_back(child);
+				_terminal[child] = _needle_at[child] != none;
+			}
+		}
+		for (size_t b = 0; b < 256; ++b) {
+			if (_narrow[b] != 0 && _first_class[_narrow[b]]) {
+				_first_bytes.insert(char(b));
+			}
+		}
+
+		for (size_t i = 0; i < queue.size(); ++i) {
+			const uint32_t state = queue[i];
+			const size_t row = state * size_t(_class_count);
+			const size_t fail_row = fail[state] * size_t(_class_count);
+
+			for (uint32_t c = 0; c < _class_count; ++c) {
+				const uint32_t child = _delta[row + c];
+				if (child == 0) {
+					_delta[row + c] = _delta[fail_row + c];
+					continue;
+				}
+
+				const uint32_t f = _delta[fail_row + c];
+				fail[child] = f;
+				// The nearest suffix state which ends a needle.
+				_output_link[child]
+						= _needle_at[f] != none ? f : _output_link[f];
+				_terminal[child] = _needle_at[child] != none
+						|| _output_link[child] != 0;
+				queue.push_back(child);
+			}
+		}
+	}
+
+	// Returns the next position which can start a needle, or npos.
+	[[nodiscard]] size_t skip(view_type str, size_t pos) const {
+		if constexpr (std::is_same_v<CharT, char>) {
+			return _first_bytes.find_first_of(str, pos);
+		} else {
+			for (; pos < str.size(); ++pos) {
+				if (_first_class[unit_class(str[pos])]) {
+					return pos;
+				}
+			}
+			return view_type::npos;
+		}
+	}
+
+	// Runs the automaton. Calls bool(uint32_t state, size_t end) on states
+	// which end needles, stops when it returns false.
+	template <class Func>
+	void scan(view_type str, Func&& on_match) const {
+		uint32_t state = 0;
+		for (size_t i = 0; i < str.size(); ++i) {
+			if (state == 0) {
+				i = skip(str, i);
+				if (i == view_type::npos) {
+					return;
+				}
+			}
+
+			state = _delta[state * size_t(_class_count) + unit_class(str[i])];
+			if (_terminal[state] && !on_match(state, i + 1)) {
+				return;
+			}
+		}
+	}
+
+	// Calls func with every needle ending at state.
+	template <class Func>
+	void for_each_output(uint32_t state, Func&& func) const {
+		for (uint32_t s = state; s != 0; s = _output_link[s]) {
+			for (uint32_t n = _needle_at[s]; n != none; n = _next_same[n]) {
+				func(size_t(n));
+			}
+		}
+	}
+
+	// Unit classes.
+	uint32_t _narrow[256]{};
+	std::vector<uint32_t> _wide;
+	uint32_t _wide_first{ 0 };
+	uint32_t _class_count{ 1 };
+
+	// The classes and bytes which can start a needle.
+	std::vector<bool> _first_class = std::vector<bool>(1, false);
+	char_set _first_bytes;
+
+	// The automaton, a row of class_count transitions per state.
+	std::vector<uint32_t> _delta = std::vector<uint32_t>(1, 0);
+	// The last needle ending exactly at each state, or none.
+	std::vector<uint32_t> _needle_at = std::vector<uint32_t>(1, none);
+	// The next identical needle.
+	std::vector<uint32_t> _next_same;
+	// The nearest suffix state ending a needle, 0 if none.
+	std::vector<uint32_t> _output_link = std::vector<uint32_t>(1, 0);
+	// Does any needle end at the state.
+	std::vector<bool> _terminal = std::vector<bool>(1, false);
+	std::vector<size_t> _lengths;
+	size_t _match_count{ 0 };
+};
+
+using multi_searcher = basic_multi_searcher<char>;
+using wmulti_searcher = basic_multi_searcher<wchar_t>;
+} // namespace fea
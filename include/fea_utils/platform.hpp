@@ -153,4 +153,26 @@ inline constexpr platform_group_t platform_group = platform_group_t::unixx;
 inline constexpr platform_group_t platform_group = platform_group_t::count;
 #endif
 
+// Instruction sets enabled at compile time.
+//#define FEA_SSE2 0
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) \
+		|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#undef FEA_SSE2
+#define FEA_SSE2 1
+inline constexpr bool has_sse2 = true;
+#else
+inline constexpr bool has_sse2 = false;
+#endif
+
+//#define FEA_SSSE3 0
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#undef FEA_SSSE3
+#define FEA_SSSE3 1
+inline constexpr bool has_ssse3 = true;
+#else
+inline constexpr bool has_ssse3 = false;
+#endif
+
 } // namespace fea
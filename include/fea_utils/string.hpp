@@ -32,14 +32,21 @@
  **/
 
 #pragma once
+#include "fea_utils/char_set.hpp"
+#include "fea_utils/codepage.hpp"
 #include "fea_utils/platform.hpp"
+#include "fea_utils/unicode.hpp"
 
 #include <algorithm>
 #include <cassert>
-#include <codecvt>
-#include <locale>
+#include <cctype>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #if defined(FEA_WINDOWS)
@@ -90,37 +97,71 @@ template <class CharT>
 using m_string = std::basic_string<CharT, std::char_traits<CharT>,
 		std::allocator<CharT>>;
 
-template <class CharT>
-[[nodiscard]] inline bool contains(
-		const m_string<CharT>& str, const m_string<CharT>& search) {
-	return str.find(search) != m_string<CharT>::npos;
+// Views strings, string views and null terminated strings alike.
+template <class CharT, class Traits>
+[[nodiscard]] constexpr std::basic_string_view<CharT, Traits> to_string_view(
+		std::basic_string_view<CharT, Traits> str) noexcept {
+	return str;
+}
+template <class CharT, class Traits, class Alloc>
+[[nodiscard]] constexpr std::basic_string_view<CharT, Traits> to_string_view(
+		const std::basic_string<CharT, Traits, Alloc>& str) noexcept {
+	return { str.data(), str.size() };
 }
 template <class CharT>
-[[nodiscard]] inline bool contains(
-		const m_string<CharT>& str, const CharT* search) {
-	return str.find(search) != m_string<CharT>::npos;
+[[nodiscard]] constexpr std::basic_string_view<CharT> to_string_view(
+		const CharT* str) noexcept {
+	return str;
 }
 
-template <class CharT>
-[[nodiscard]] inline bool starts_with(
-		const m_string<CharT>& str, const m_string<CharT>& search) {
-	return str.find(search) == 0;
+// Predicates accept any mix of strings, views and literals of the same
+// character type. They never allocate, and only compare what they must.
+// Other argument types don't take part in overload resolution.
+
+// The return type of string functions taking Str and Search, if both can be
+// viewed as strings.
+template <class Ret, class Str, class Search>
+using string_function_t
+		= decltype(to_string_view(std::declval<const Str&>()),
+				to_string_view(std::declval<const Search&>()), Ret());
+
+template <class Str, class Search>
+[[nodiscard]] constexpr string_function_t<bool, Str, Search> contains(
+		const Str& str, const Search& search) {
+	return to_string_view(str).find(to_string_view(search))
+			!= std::string_view::npos;
 }
-template <class CharT>
-[[nodiscard]] inline bool starts_with(
-		const m_string<CharT>& str, const CharT* search) {
-	return str.find(search) == 0;
+
+template <class Str, class Search>
+[[nodiscard]] constexpr string_function_t<bool, Str, Search> starts_with(
+		const Str& str, const Search& search) {
+	const auto s = to_string_view(str);
+	const auto se = to_string_view(search);
+	return s.size() >= se.size() && s.compare(0, se.size(), se) == 0;
 }
 
-template <class CharT>
-[[nodiscard]] inline bool ends_with(
-		const m_string<CharT>& str, const m_string<CharT>& search) {
-	return str.find_last_of(search) == str.size() - search.size();
+template <class Str, class Search>
+[[nodiscard]] constexpr string_function_t<bool, Str, Search> ends_with(
+		const Str& str, const Search& search) {
+	const auto s = to_string_view(str);
+	const auto se = to_string_view(search);
+	return s.size() >= se.size()
+			&& s.compare(s.size() - se.size(), se.size(), se) == 0;
 }
-template <class CharT>
-[[nodiscard]] inline bool ends_with(
-		const m_string<CharT>& str, const CharT* search) {
-	return ends_with(str, m_string<CharT>{ search });
+
+template <class Lhs, class Rhs>
+[[nodiscard]] constexpr string_function_t<bool, Lhs, Rhs> equals(
+		const Lhs& lhs, const Rhs& rhs) {
+	const auto l = to_string_view(lhs);
+	const auto r = to_string_view(rhs);
+	return l.size() == r.size() && l.compare(r) == 0;
+}
+
+// Lexicographical comparison. Returns < 0, 0 or > 0.
+template <class Lhs, class Rhs>
+[[nodiscard]] constexpr string_function_t<int, Lhs, Rhs> compare(
+		const Lhs& lhs, const Rhs& rhs) {
+	return to_string_view(lhs).compare(to_string_view(rhs));
 }
 
 template <class CharT>
@@ -150,22 +191,219 @@ inline void to_lower(std::vector<uint8_t>& out, bool /*inplace*/) {
 			[](char c) { return static_cast<char>(::tolower(c)); });
 }
 
+// Returns str without the leading bytes in the set.
+[[nodiscard]] inline std::string_view trim_left(
+		std::string_view str, const char_set& set = whitespace_set) {
+	const size_t pos = set.find_first_not_of(str);
+	return pos == std::string_view::npos ? std::string_view{}
+										 : str.substr(pos);
+}
+
+// Returns str without the trailing bytes in the set.
+[[nodiscard]] inline std::string_view trim_right(
+		std::string_view str, const char_set& set = whitespace_set) {
+	return str.substr(0, set.find_last_not_of(str) + 1);
+}
+
+// Returns str without the leading and trailing bytes in the set.
+[[nodiscard]] inline std::string_view trim(
+		std::string_view str, const char_set& set = whitespace_set) {
+	return trim_right(trim_left(str, set), set);
+}
+
+enum class split_delimiter : unsigned {
+	// Each delimiter character splits.
+	any_of,
+	// The whole delimiter string splits.
+	sequence,
+	count,
+};
+
+struct split_options {
+	split_delimiter delimiter = split_delimiter::any_of;
+
+	// Yields the empty tokens between adjacent delimiters, and at the ends.
+	bool keep_empty = false;
+
+	// Stops after this many tokens were split off, the rest of the string is
+	// the last token.
+	size_t max_splits = std::numeric_limits<size_t>::max();
+};
+
+// A lazy range of the tokens of a string. Tokens are views in the string,
+// found as you iterate. Nothing is allocated.
+// The string and delimiters must outlive the view.
 template <class CharT>
-[[nodiscard]] inline std::vector<m_string<CharT>> split(
-		const m_string<CharT>& str, const CharT* delimiters) {
-	std::vector<m_string<CharT>> tokens;
-	size_t prev = 0;
-	size_t pos;
+struct basic_split_view {
+	using view_type = std::basic_string_view<CharT>;
+
+	basic_split_view(
+			view_type str, view_type delimiters, const split_options& opts = {})
+			: _str(str)
+			, _delimiters(delimiters)
+			, _opts(opts) {
+		if constexpr (std::is_same_v<CharT, char>) {
+			_set = char_set{ delimiters };
+		}
+	}
+	basic_split_view(
+			view_type str, CharT delimiter, const split_options& opts = {})
+			: _str(str)
+			, _delimiter(delimiter)
+			, _single(true)
+			, _opts(opts) {
+	}
+
+	struct const_iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = view_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const view_type*;
+		using reference = const view_type&;
 
-	while ((pos = str.find_first_of(delimiters, prev))
-			!= m_string<CharT>::npos) {
-		if (pos > prev) {
-			tokens.push_back(str.substr(prev, pos - prev));
+		const_iterator() = default;
+
+		reference operator*() const {
+			return _token;
+		}
+		pointer operator->() const {
+			return &_token;
 		}
-		prev = pos + 1;
+
+		const_iterator& operator++() {
+			advance();
+			return *this;
+		}
+		const_iterator operator++(int) {
+			const_iterator ret = *this;
+			advance();
+			return ret;
+		}
+
+		bool operator==(const const_iterator& other) const {
+			return _start == other._start;
+		}
+		bool operator!=(const const_iterator& other) const {
+			return _start != other._start;
+		}
+
+	private:
+		friend basic_split_view;
+
+		explicit const_iterator(const basic_split_view* view)
+				: _view(view) {
+			advance();
+		}
+
+		void advance() {
+			const view_type str = _view->_str;
+			const split_options& opts = _view->_opts;
+
+			while (true) {
+				if (_next == view_type::npos) {
+					_start = view_type::npos;
+					return;
+				}
+
+				_start = _next;
+				size_t delim_size = 0;
+				const size_t pos = _splits < opts.max_splits
+						? _view->find_delimiter(_start, delim_size)
+						: view_type::npos;
+
+				if (pos == view_type::npos) {
+					_token = str.substr(_start);
+					_next = view_type::npos;
+				} else {
+					_token = str.substr(_start, pos - _start);
+					_next = pos + delim_size;
+				}
+
+				if (!_token.empty() || opts.keep_empty) {
+					_splits += pos != view_type::npos;
+					return;
+				}
+			}
+		}
+
+		const basic_split_view* _view{ nullptr };
+		view_type _token;
+		// Where the current token starts, npos once done.
+		size_t _start{ view_type::npos };
+		// Where the next token starts, npos after the last one.
+		size_t _next{ 0 };
+		size_t _splits{ 0 };
+	};
+	using iterator = const_iterator;
+
+	[[nodiscard]] const_iterator begin() const {
+		return const_iterator{ this };
+	}
+
+	[[nodiscard]] const_iterator end() const {
+		return const_iterator{};
 	}
-	if (prev < str.length()) {
-		tokens.push_back(str.substr(prev, m_string<CharT>::npos));
+
+private:
+	// Returns the position of the next delimiter, and its size.
+	size_t find_delimiter(size_t from, size_t& delim_size) const {
+		if (_single) {
+			delim_size = 1;
+			return _str.find(_delimiter, from);
+		}
+
+		if (_opts.delimiter == split_delimiter::sequence) {
+			delim_size = _delimiters.size();
+			return _delimiters.empty() ? view_type::npos
+									   : _str.find(_delimiters, from);
+		}
+
+		delim_size = 1;
+		if constexpr (std::is_same_v<CharT, char>) {
+			return _set.find_first_of(_str, from);
+		} else {
+			return _str.find_first_of(_delimiters, from);
+		}
+	}
+
+	view_type _str;
+	view_type _delimiters;
+	CharT _delimiter{};
+	bool _single{ false };
+	split_options _opts;
+	// The compiled delimiters, for byte strings.
+	char_set _set;
+};
+
+// Lazily splits str on any of the delimiter characters, or on the whole
+// delimiter string with split_delimiter::sequence.
+template <class Str, class Delims,
+		class = decltype(to_string_view(std::declval<const Delims&>()))>
+[[nodiscard]] auto split_view(const Str& str, const Delims& delimiters,
+		const split_options& opts = {}) {
+	const auto s = to_string_view(str);
+	using char_t = typename decltype(s)::value_type;
+	return basic_split_view<char_t>{ s, to_string_view(delimiters), opts };
+}
+
+// Lazily splits str on the delimiter.
+template <class Str>
+[[nodiscard]] auto split_view(const Str& str,
+		typename decltype(to_string_view(std::declval<const Str&>()))::value_type
+				delimiter,
+		const split_options& opts = {}) {
+	const auto s = to_string_view(str);
+	using char_t = typename decltype(s)::value_type;
+	return basic_split_view<char_t>{ s, delimiter, opts };
+}
+
+// Splits on any of the delimiters, skipping empty tokens.
+template <class CharT>
+[[nodiscard]] inline std::vector<m_string<CharT>> split(
+		const m_string<CharT>& str, const CharT* delimiters) {
+	std::vector<m_string<CharT>> tokens;
+	for (std::basic_string_view<CharT> token : split_view(str, delimiters)) {
+		tokens.emplace_back(token);
 	}
 	return tokens;
 }
@@ -173,87 +411,277 @@ template <class CharT>
 template <class CharT>
 [[nodiscard]] inline std::vector<m_string<CharT>> split(
 		const m_string<CharT>& str, CharT delimiter) {
-	m_string<CharT> delim{ delimiter };
-	return split(str, delim.c_str());
+	std::vector<m_string<CharT>> tokens;
+	for (std::basic_string_view<CharT> token : split_view(str, delimiter)) {
+		tokens.emplace_back(token);
+	}
+	return tokens;
 }
 
 
+// Returns str with every search replaced. Matches are counted first, so the
+// result is allocated at its exact size and written once.
 template <class CharT>
-inline void replace_all(m_string<CharT>& out, const m_string<CharT>& search,
-		const m_string<CharT>& replace, bool /*inplace*/) {
+[[nodiscard]] m_string<CharT> basic_replace_all(std::basic_string_view<CharT> str,
+		std::basic_string_view<CharT> search,
+		std::basic_string_view<CharT> replace) {
+	using view_type = std::basic_string_view<CharT>;
+
+	size_t count = 0;
+	if (!search.empty()) {
+		for (size_t pos = str.find(search); pos != view_type::npos;
+				pos = str.find(search, pos + search.size())) {
+			++count;
+		}
+	}
+	if (count == 0) {
+		return m_string<CharT>{ str };
+	}
+
+	m_string<CharT> ret;
+	ret.reserve(str.size() - count * search.size() + count * replace.size());
+	size_t prev = 0;
+	for (size_t pos = str.find(search); pos != view_type::npos;
+			pos = str.find(search, prev)) {
+		ret.append(str.data() + prev, pos - prev);
+		ret.append(replace);
+		prev = pos + search.size();
+	}
+	ret.append(str.data() + prev, str.size() - prev);
+	return ret;
+}
 
-	size_t pos = out.find(search);
+// Replaces every search in out. When the replacement isn't longer, the
+// string is compacted in place, in one pass and without allocating.
+template <class CharT>
+void basic_replace_all(m_string<CharT>& out,
+		std::basic_string_view<CharT> search,
+		std::basic_string_view<CharT> replace) {
+	using traits = typename m_string<CharT>::traits_type;
+	if (search.empty()) {
+		return;
+	}
+
+	if (replace.size() > search.size()) {
+		out = basic_replace_all(std::basic_string_view<CharT>{ out }, search,
+				replace);
+		return;
+	}
+
+	// The write position never passes the read position.
+	const std::basic_string_view<CharT> str{ out };
+	size_t pos = str.find(search);
+	size_t write = pos;
 	while (pos != m_string<CharT>::npos) {
-		out.replace(pos, search.size(), replace);
-		--pos;
-		pos = out.find(search, pos + search.size());
+		traits::copy(out.data() + write, replace.data(), replace.size());
+		write += replace.size();
+
+		const size_t read = pos + search.size();
+		pos = str.find(search, read);
+		const size_t end = pos == m_string<CharT>::npos ? str.size() : pos;
+		traits::move(out.data() + write, out.data() + read, end - read);
+		write += end - read;
+	}
+
+	if (write != m_string<CharT>::npos) {
+		out.resize(write);
 	}
 }
+
+template <class CharT>
+inline void replace_all(m_string<CharT>& out, const m_string<CharT>& search,
+		const m_string<CharT>& replace, bool /*inplace*/) {
+	basic_replace_all<CharT>(out, search, replace);
+}
 template <class CharT>
 inline void replace_all(m_string<CharT>& out, const CharT* search,
 		const CharT* replace, bool /*inplace*/) {
-	replace_all(
-			out, m_string<CharT>{ search }, m_string<CharT>{ replace }, true);
+	basic_replace_all<CharT>(out, search, replace);
 }
 
 template <class CharT>
 [[nodiscard]] inline m_string<CharT> replace_all(const m_string<CharT>& str,
 		const m_string<CharT>& search, const m_string<CharT>& replace) {
-	m_string<CharT> ret = str;
-	replace_all(ret, search, replace, true);
-	return ret;
+	return basic_replace_all<CharT>(str, search, replace);
 }
 template <class CharT>
 [[nodiscard]] inline m_string<CharT> replace_all(
 		const m_string<CharT>& str, const CharT* search, const CharT* replace) {
-	return replace_all(
-			str, m_string<CharT>{ search }, m_string<CharT>{ replace });
+	return basic_replace_all<CharT>(str, search, replace);
 }
 
+// Replaces many patterns in a single pass. At each position, patterns are
+// tried in the order they were given, and the first match is replaced.
+// Replaced text isn't searched again. Empty patterns are ignored.
+template <class CharT>
+struct basic_replacer {
+	using view_type = std::basic_string_view<CharT>;
+	using string_type = m_string<CharT>;
+	using pair_type = std::pair<view_type, view_type>;
 
-// The standard doesn't provide codecvt equivalents. Use the old
-// functionality until they do.
-#if defined(FEA_WINDOWS)
-#pragma warning(push)
-#pragma warning(disable : 4996)
-#endif
+	basic_replacer(std::initializer_list<pair_type> pairs)
+			: basic_replacer(pairs.begin(), pairs.end()) {
+	}
+
+	// Takes an iterator range of pairs of strings, from and to.
+	// The patterns are copied.
+	template <class FwdIt>
+	basic_replacer(FwdIt first, FwdIt last) {
+		for (; first != last; ++first) {
+			view_type from = to_string_view(first->first);
+			if (from.empty()) {
+				continue;
+			}
+			_from.emplace_back(from);
+			_to.emplace_back(to_string_view(first->second));
+		}
+
+		// Bucket the patterns by the low byte of their first unit, keeping
+		// their order.
+		_order.resize(_from.size());
+		size_t counts[256]{};
+		for (const string_type& from : _from) {
+			++counts[bucket(from[0])];
+		}
+		for (size_t i = 0; i < 256; ++i) {
+			_bucket_begin[i + 1] = _bucket_begin[i] + counts[i];
+		}
+		size_t fill[256];
+		std::copy(_bucket_begin, _bucket_begin + 256, fill);
+		for (size_t i = 0; i < _from.size(); ++i) {
+			_order[fill[bucket(_from[i][0])]++] = i;
+			_first.insert(char(bucket(_from[i][0])));
+		}
+	}
+
+	// Returns str with every pattern replaced.
+	[[nodiscard]] string_type replace(view_type str) const {
+		string_type ret;
+		replace(str, ret);
+		return ret;
+	}
+
+	// Writes str with every pattern replaced in out, reusing its memory.
+	void replace(view_type str, string_type& out) const {
+		out.clear();
+		out.reserve(str.size());
+
+		size_t copied = 0;
+		size_t pos = find_candidate(str, 0);
+		while (pos < str.size()) {
+			const size_t idx = match_at(str, pos);
+			if (idx == view_type::npos) {
+				pos = find_candidate(str, pos + 1);
+				continue;
+			}
+
+			out.append(str.data() + copied, pos - copied);
+			out.append(_to[idx]);
+			copied = pos + _from[idx].size();
+			pos = find_candidate(str, copied);
+		}
+		out.append(str.data() + copied, str.size() - copied);
+	}
+
+private:
+	static constexpr size_t bucket(CharT c) {
+		return size_t(unit_value(c) & 0xFF);
+	}
+
+	// Returns the next position which can start a pattern, or npos.
+	size_t find_candidate(view_type str, size_t pos) const {
+		if constexpr (std::is_same_v<CharT, char>) {
+			return _first.find_first_of(str, pos);
+		} else {
+			for (; pos < str.size(); ++pos) {
+				if (_first.contains(char(bucket(str[pos])))) {
+					return pos;
+				}
+			}
+			return view_type::npos;
+		}
+	}
+
+	// Returns the index of the first pattern matching at pos, or npos.
+	size_t match_at(view_type str, size_t pos) const {
+		const size_t b = bucket(str[pos]);
+		const view_type rest = str.substr(pos);
+		for (size_t i = _bucket_begin[b]; i < _bucket_begin[b + 1]; ++i) {
+			const size_t idx = _order[i];
+			if (starts_with(rest, _from[idx])) {
+				return idx;
+			}
+		}
+		return view_type::npos;
+	}
+
+	std::vector<string_type> _from;
+	std::vector<string_type> _to;
+	// Pattern indices, grouped by bucket.
+	std::vector<size_t> _order;
+	size_t _bucket_begin[257]{};
+	// The buckets which have patterns.
+	char_set _first;
+};
+
+using replacer = basic_replacer<char>;
+using wreplacer = basic_replacer<wchar_t>;
+
+// Replaces many patterns in a single pass, see basic_replacer.
+template <class CharT>
+[[nodiscard]] m_string<CharT> replace_all(const m_string<CharT>& str,
+		std::initializer_list<typename basic_replacer<CharT>::pair_type>
+				pairs) {
+	return basic_replacer<CharT>{ pairs }.replace(str);
+}
+template <class CharT>
+void replace_all(m_string<CharT>& out,
+		std::initializer_list<typename basic_replacer<CharT>::pair_type>
+				pairs,
+		bool /*inplace*/) {
+	out = basic_replacer<CharT>{ pairs }.replace(out);
+}
+
+
+// Unicode conversions. Invalid input throws std::range_error.
+// See unicode.hpp for the kernels.
 
 // From UTF8 (multi-byte)
 
 // UTF-8 to UTF-16
 inline std::u16string utf8_to_utf16(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
-	return convert.from_bytes(s);
+	return transcode_string<utf8_codec, utf16_codec<char16_t>>(
+			s, "utf8_to_utf16");
 }
 
 // UTF-8 to UTF-16, in wstring. Aka Windows "unicode".
 inline std::wstring utf8_to_utf16_w(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> convert;
-	return convert.from_bytes(s);
+	return transcode_string<utf8_codec, utf16_codec<wchar_t>>(
+			s, "utf8_to_utf16_w");
 }
 
 // UTF-8 to UTF-16, encoded in 32bits. This is dumb, don't use this.
 inline std::u32string utf8_to_utf16_32bits(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<char32_t>, char32_t> convert;
-	return convert.from_bytes(s);
+	return transcode_string<utf8_codec, utf16_codec<char32_t>>(
+			s, "utf8_to_utf16_32bits");
 }
 
 // UTF-8 to UCS2, outdated format.
 inline std::u16string utf8_to_ucs2(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8<char16_t>, char16_t> convert;
-	return convert.from_bytes(s);
+	return transcode_string<utf8_codec, ucs2_codec<char16_t>>(
+			s, "utf8_to_ucs2");
 }
 
 // UTF-8 to UCS2, in wstring. Outdated format.
 inline std::wstring utf8_to_ucs2_w(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> convert;
-	return convert.from_bytes(s);
+	return transcode_string<utf8_codec, ucs2_codec<wchar_t>>(
+			s, "utf8_to_ucs2_w");
 }
 
 // UTF-8 to UTF-32
 inline std::u32string utf8_to_utf32(const std::string& s) {
-	std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
-	return conv.from_bytes(s);
+	return transcode_string<utf8_codec, utf32_codec<char32_t>>(
+			s, "utf8_to_utf32");
 }
 
 
@@ -261,50 +689,56 @@ inline std::u32string utf8_to_utf32(const std::string& s) {
 
 // UTF-16 to UTF-8
 inline std::string utf16_to_utf8(const std::u16string& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<utf16_codec<char16_t>, utf8_codec>(
+			s, "utf16_to_utf8");
 }
 
 // UTF-16 to UTF-8, using wstring.
 inline std::string utf16_to_utf8(const std::wstring& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>, wchar_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<utf16_codec<wchar_t>, utf8_codec>(
+			s, "utf16_to_utf8");
 }
 
 // UTF-16 to UTF-8, using 32bit encoded UTF-16 (aka, dumb).
 inline std::string utf16_to_utf8(const std::u32string& s) {
-	std::wstring_convert<std::codecvt_utf8_utf16<char32_t>, char32_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<utf16_codec<char32_t>, utf8_codec>(
+			s, "utf16_to_utf8");
 }
 
 // UTF-16 to UCS2, outdated format.
 inline std::u16string utf16_to_ucs2(const std::u16string& s) {
-	return utf8_to_ucs2(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<char16_t>, ucs2_codec<char16_t>>(
+			s, "utf16_to_ucs2");
 }
 
 // UTF-16 to UCS2, outdated format.
 inline std::u16string utf16_to_ucs2(const std::wstring& s) {
-	return utf8_to_ucs2(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<wchar_t>, ucs2_codec<char16_t>>(
+			s, "utf16_to_ucs2");
 }
 
 // UTF-16 to UCS2, outdated format.
 inline std::wstring utf16_to_ucs2_w(const std::u16string& s) {
-	return utf8_to_ucs2_w(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<char16_t>, ucs2_codec<wchar_t>>(
+			s, "utf16_to_ucs2_w");
 }
 
 // UTF-16 to UCS2, outdated format.
 inline std::wstring utf16_to_ucs2_w(const std::wstring& s) {
-	return utf8_to_ucs2_w(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<wchar_t>, ucs2_codec<wchar_t>>(
+			s, "utf16_to_ucs2_w");
 }
 
 // UTF-16 to UTF-32.
 inline std::u32string utf16_to_utf32(const std::u16string& s) {
-	return utf8_to_utf32(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<char16_t>, utf32_codec<char32_t>>(
+			s, "utf16_to_utf32");
 }
 
 // UTF-16 to UTF-32.
 inline std::u32string utf16_to_utf32(const std::wstring& s) {
-	return utf8_to_utf32(utf16_to_utf8(s));
+	return transcode_string<utf16_codec<wchar_t>, utf32_codec<char32_t>>(
+			s, "utf16_to_utf32");
 }
 
 
@@ -312,54 +746,61 @@ inline std::u32string utf16_to_utf32(const std::wstring& s) {
 
 // UCS2 to UTF-8
 inline std::string ucs2_to_utf8(const std::u16string& s) {
-	std::wstring_convert<std::codecvt_utf8<char16_t>, char16_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<ucs2_codec<char16_t>, utf8_codec>(
+			s, "ucs2_to_utf8");
 }
 
 // UCS2 to UTF-8, using wstring.
 inline std::string ucs2_to_utf8(const std::wstring& s) {
-	std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<ucs2_codec<wchar_t>, utf8_codec>(s, "ucs2_to_utf8");
 }
 
 // UCS2 to UTF-16.
 inline std::u16string ucs2_to_utf16(const std::u16string& s) {
-	return utf8_to_utf16(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<char16_t>, utf16_codec<char16_t>>(
+			s, "ucs2_to_utf16");
 }
 
 // UCS2 to UTF-16.
 inline std::u16string ucs2_to_utf16(const std::wstring& s) {
-	return utf8_to_utf16(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<wchar_t>, utf16_codec<char16_t>>(
+			s, "ucs2_to_utf16");
 }
 
 // UCS2 to UTF-16.
 inline std::wstring ucs2_to_utf16_w(const std::u16string& s) {
-	return utf8_to_utf16_w(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<char16_t>, utf16_codec<wchar_t>>(
+			s, "ucs2_to_utf16_w");
 }
 
 // UCS2 to UTF-16.
 inline std::wstring ucs2_to_utf16_w(const std::wstring& s) {
-	return utf8_to_utf16_w(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<wchar_t>, utf16_codec<wchar_t>>(
+			s, "ucs2_to_utf16_w");
 }
 
 // UCS2 to 32bit encoded UTF-16.
 inline std::u32string ucs2_to_utf16_32bit(const std::u16string& s) {
-	return utf8_to_utf16_32bits(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<char16_t>, utf16_codec<char32_t>>(
+			s, "ucs2_to_utf16_32bit");
 }
 
 // UCS2 to 32bit encoded UTF-16.
 inline std::u32string ucs2_to_utf16_32bit(const std::wstring& s) {
-	return utf8_to_utf16_32bits(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<wchar_t>, utf16_codec<char32_t>>(
+			s, "ucs2_to_utf16_32bit");
 }
 
 // UCS2 to UTF-32.
 inline std::u32string ucs2_to_utf32(const std::u16string& s) {
-	return utf8_to_utf32(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<char16_t>, utf32_codec<char32_t>>(
+			s, "ucs2_to_utf32");
 }
 
 // UCS2 to UTF-32.
 inline std::u32string ucs2_to_utf32(const std::wstring& s) {
-	return utf8_to_utf32(ucs2_to_utf8(s));
+	return transcode_string<ucs2_codec<wchar_t>, utf32_codec<char32_t>>(
+			s, "ucs2_to_utf32");
 }
 
 
@@ -367,51 +808,57 @@ inline std::u32string ucs2_to_utf32(const std::wstring& s) {
 
 // UTF-32 to UTF-8
 inline std::string utf32_to_utf8(const std::u32string& s) {
-	std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
-	return conv.to_bytes(s);
+	return transcode_string<utf32_codec<char32_t>, utf8_codec>(
+			s, "utf32_to_utf8");
 }
 
 // UTF-32 to UTF-16
 inline std::u16string utf32_to_utf16(const std::u32string& s) {
-	return utf8_to_utf16(utf32_to_utf8(s));
+	return transcode_string<utf32_codec<char32_t>, utf16_codec<char16_t>>(
+			s, "utf32_to_utf16");
 }
 
 // UTF-32 to UTF-16, using wstring
 inline std::wstring utf32_to_utf16_w(const std::u32string& s) {
-	return utf8_to_utf16_w(utf32_to_utf8(s));
+	return transcode_string<utf32_codec<char32_t>, utf16_codec<wchar_t>>(
+			s, "utf32_to_utf16_w");
 }
 
 // UTF-32 to 32bit encoded UTF-16
 inline std::u32string utf32_to_utf16_32bit(const std::u32string& s) {
-	return utf8_to_utf16_32bits(utf32_to_utf8(s));
+	return transcode_string<utf32_codec<char32_t>, utf16_codec<char32_t>>(
+			s, "utf32_to_utf16_32bit");
 }
 
 // UTF-32 to UCS2, outdated format.
 inline std::u16string utf32_to_ucs2(const std::u32string& s) {
-	return utf8_to_ucs2(utf32_to_utf8(s));
+	return transcode_string<utf32_codec<char32_t>, ucs2_codec<char16_t>>(
+			s, "utf32_to_ucs2");
 }
 
 // UTF-32 to UCS2, using wstring.
 inline std::wstring utf32_to_ucs2_w(const std::u32string& s) {
-	return utf8_to_ucs2_w(utf32_to_utf8(s));
+	return transcode_string<utf32_codec<char32_t>, ucs2_codec<wchar_t>>(
+			s, "utf32_to_ucs2_w");
 }
 
 
 // Useful generalized conversions
 
+// The encoding these conversions read and write for CharT. Unlike codec_of,
+// wchar_t strings hold utf16 on every platform, as with utf8_to_utf16_w.
+// Use fea::transcode for the native wchar_t encoding.
+template <class CharT>
+using any_codec_t = std::conditional_t<std::is_same_v<CharT, wchar_t>,
+		utf16_codec<wchar_t>, codec_of_t<CharT>>;
+
 template <class CharT>
 std::string any_to_utf8(const m_string<CharT>& str) {
 	if constexpr (std::is_same_v<CharT, char>) {
 		return str;
-	} else if constexpr (std::is_same_v<CharT, wchar_t>) {
-		return utf16_to_utf8(str);
-	} else if constexpr (std::is_same_v<CharT, char16_t>) {
-		return utf16_to_utf8(str);
-	} else if constexpr (std::is_same_v<CharT, char32_t>) {
-		return utf32_to_utf8(str);
 	} else {
-		assert(false);
-		throw std::runtime_error{ "any_to_utf8 : unsupported string type" };
+		return transcode_string<any_codec_t<CharT>, utf8_codec>(
+				str, "any_to_utf8");
 	}
 }
 
@@ -419,65 +866,88 @@ template <class CharT>
 m_string<CharT> utf8_to_any(const std::string& str) {
 	if constexpr (std::is_same_v<CharT, char>) {
 		return str;
-	} else if constexpr (std::is_same_v<CharT, wchar_t>) {
-		return utf8_to_utf16_w(str);
-	} else if constexpr (std::is_same_v<CharT, char16_t>) {
-		return utf8_to_utf16(str);
-	} else if constexpr (std::is_same_v<CharT, char32_t>) {
-		return utf8_to_utf32(str);
 	} else {
-		assert(false);
-		throw std::runtime_error{ "utf8_to_any : unsupported string type" };
+		return transcode_string<utf8_codec, any_codec_t<CharT>>(
+				str, "utf8_to_any");
 	}
 }
 
 template <class CharT>
 std::u32string any_to_utf32(const m_string<CharT>& str) {
-	if constexpr (std::is_same_v<CharT, char>) {
-		return utf8_to_utf32(str);
-	} else if constexpr (std::is_same_v<CharT, wchar_t>) {
-		return utf16_to_utf32(str);
-	} else if constexpr (std::is_same_v<CharT, char16_t>) {
-		return utf16_to_utf32(str);
-	} else if constexpr (std::is_same_v<CharT, char32_t>) {
+	if constexpr (std::is_same_v<CharT, char32_t>) {
 		return str;
 	} else {
-		assert(false);
-		throw std::runtime_error{ "any_to_utf32 : unsupported string type" };
+		return transcode_string<any_codec_t<CharT>, utf32_codec<char32_t>>(
+				str, "any_to_utf32");
 	}
 }
 
 template <class CharT>
 m_string<CharT> utf32_to_any(const std::u32string& str) {
-	if constexpr (std::is_same_v<CharT, char>) {
-		return utf32_to_utf8(str);
-	} else if constexpr (std::is_same_v<CharT, wchar_t>) {
-		return utf32_to_utf16_w(str);
-	} else if constexpr (std::is_same_v<CharT, char16_t>) {
-		return utf32_to_utf16(str);
-	} else if constexpr (std::is_same_v<CharT, char32_t>) {
+	if constexpr (std::is_same_v<CharT, char32_t>) {
 		return str;
 	} else {
-		assert(false);
-		throw std::runtime_error{ "utf32_to_any : unsupported string type" };
+		return transcode_string<utf32_codec<char32_t>, any_codec_t<CharT>>(
+				str, "utf32_to_any");
 	}
 }
 
 // Other Encodings.
 
 inline std::string iso_8859_1_to_utf8(const std::string& str) {
-	std::string ret;
-	ret.reserve(str.size());
+	return transcode_string<iso_8859_1_codec, utf8_codec>(
+			str, "iso_8859_1_to_utf8");
+}
 
-	for (uint8_t ch : str) {
-		if (ch < 128u) {
-			ret.push_back(ch);
-		} else {
-			ret.push_back(0b1100'0000 | ch >> 6);
-			ret.push_back(0b1000'0000 | (ch & 0b0011'1111));
-		}
-	}
-	return ret;
+// Single-byte codepages, on every platform. See codepage.hpp.
+// Undefined bytes and unrepresentable code points throw std::range_error.
+
+// Codepage to UTF-8.
+inline std::string codepage_to_utf8(codepage page, std::string_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<decltype(codec), utf8_codec>(
+				s, "codepage_to_utf8");
+	});
+}
+
+// Codepage to UTF-16.
+inline std::u16string codepage_to_utf16(codepage page, std::string_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<decltype(codec), utf16_codec<char16_t>>(
+				s, "codepage_to_utf16");
+	});
+}
+
+// Codepage to UTF-16, in wstring.
+inline std::wstring codepage_to_utf16_w(codepage page, std::string_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<decltype(codec), utf16_codec<wchar_t>>(
+				s, "codepage_to_utf16_w");
+	});
+}
+
+// UTF-8 to codepage.
+inline std::string utf8_to_codepage(codepage page, std::string_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<utf8_codec, decltype(codec)>(
+				s, "utf8_to_codepage");
+	});
+}
+
+// UTF-16 to codepage.
+inline std::string utf16_to_codepage(codepage page, std::u16string_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<utf16_codec<char16_t>, decltype(codec)>(
+				s, "utf16_to_codepage");
+	});
+}
+
+// UTF-16 to codepage, using wstring.
+inline std::string utf16_to_codepage(codepage page, std::wstring_view s) {
+	return visit_codepage(page, [&](auto codec) {
+		return transcode_string<utf16_codec<wchar_t>, decltype(codec)>(
+				s, "utf16_to_codepage");
+	});
 }
 
 
@@ -512,8 +982,4 @@ inline std::string utf16_to_current_codepage(const std::wstring& str) {
 	return utf16_to_codepage(GetACP(), str);
 }
 #endif
-
-#if defined(FEA_WINDOWS)
-#pragma warning(pop)
-#endif
 } // namespace fea
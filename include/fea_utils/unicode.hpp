@@ -0,0 +1,1022 @@
+﻿/**
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Philippe Groarke
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#pragma once
+#include "fea_utils/platform.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if defined(FEA_SSE2)
+#include <emmintrin.h>
+#endif
+
+// Unicode transcoding kernels.
+// Codecs describe how code points are stored in an encoding. Kernels pair a
+// source and destination codec, and convert in a single pass.
+namespace fea {
+// Why a conversion stopped.
+enum class transcode_error : unsigned {
+	none,
+	// Malformed input : bad sequence, overlong, surrogate or out of range.
+	invalid,
+	// The input ends in the middle of a sequence.
+	truncated,
+	// A valid code point the destination can't store (ucs2 over U+FFFF).
+	unrepresentable,
+	// Not enough room in the output.
+	output_full,
+	count,
+};
+
+struct transcode_result {
+	// Input units converted. On error, the index of the faulty sequence.
+	size_t consumed = 0;
+	// Output units written.
+	size_t written = 0;
+	transcode_error error = transcode_error::none;
+};
+
+// Returns the unsigned value of a code unit.
+template <class CharT>
+[[nodiscard]] constexpr uint32_t unit_value(CharT c) {
+	return uint32_t(std::make_unsigned_t<CharT>(c));
+}
+
+// Returns the number of set bits.
+[[nodiscard]] constexpr size_t bit_count(uint32_t v) {
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return size_t((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+// Counts the units at least as big as each threshold, in a single pass.
+// Thresholds must be greater than 0.
+template <class CharT, size_t N>
+void count_at_least(const CharT* first, size_t size,
+		const uint32_t (&thresholds)[N], size_t (&counts)[N]) {
+	for (size_t& c : counts) {
+		c = 0;
+	}
+
+	size_t i = 0;
+
+#if defined(FEA_SSE2)
+	constexpr size_t per_block = 16 / sizeof(CharT);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sign = _mm_set1_epi32(int32_t(0x80000000));
+	for (; i + per_block <= size; i += per_block) {
+		const __m128i v = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(first + i));
+
+		for (size_t j = 0; j < N; ++j) {
+			// No unsigned compares. A saturated t - v is 0 when v >= t.
+			const uint32_t t = thresholds[j];
+			__m128i ge;
+			if constexpr (sizeof(CharT) == 1) {
+				const __m128i tv = _mm_set1_epi8(char(t));
+				ge = _mm_cmpeq_epi8(_mm_subs_epu8(tv, v), zero);
+			} else if constexpr (sizeof(CharT) == 2) {
+				const __m128i tv = _mm_set1_epi16(int16_t(t));
+				ge = _mm_cmpeq_epi16(_mm_subs_epu16(tv, v), zero);
+			} else {
+				const __m128i tv
+						= _mm_set1_epi32(int32_t((t - 1) ^ 0x80000000));
+				ge = _mm_cmpgt_epi32(_mm_xor_si128(v, sign), tv);
+			}
+			counts[j] += bit_count(uint32_t(_mm_movemask_epi8(ge)))
+					/ sizeof(CharT);
+		}
+	}
+#endif
+
+	for (; i < size; ++i) {
+		const uint32_t u = unit_value(first[i]);
+		for (size_t j = 0; j < N; ++j) {
+			counts[j] += u >= thresholds[j];
+		}
+	}
+}
+
+// Codecs provide :
+// - char_type : The code unit type.
+// - cp_units : Units used by code points which take 1, 2, 3 and 4 utf8 bytes.
+//   0 if the encoding can't store them.
+// - direct_max : Units up to this value are a code point by themselves,
+//   unless they are surrogates.
+// - decode : Reads one code point and advances first. Leaves first untouched
+//   on error.
+// - size : Units needed to store a code point, 0 if it can't be stored.
+// - count_classes : Counts the code points which take 1, 2, 3 and 4 utf8
+//   bytes. Exact for valid input, never less than the valid prefix needs.
+// - encode : Writes one valid code point, returns the new output end.
+
+struct utf8_codec {
+	using char_type = char;
+	static constexpr size_t cp_units[4] = { 1, 2, 3, 4 };
+	static constexpr uint32_t direct_max = 0x7F;
+
+	static transcode_error decode(
+			const char*& first, const char* last, char32_t& cp) {
+		const uint32_t c0 = unit_value(*first);
+		if (c0 < 0x80) {
+			cp = c0;
+			++first;
+			return transcode_error::none;
+		}
+
+		// Overlongs, surrogates and code points over U+10FFFF are invalid.
+		size_t count = 0;
+		uint32_t lo = 0x80;
+		uint32_t hi = 0xBF;
+		if (c0 >= 0xC2 && c0 <= 0xDF) {
+			count = 2;
+			cp = c0 & 0x1F;
+		} else if (c0 >= 0xE0 && c0 <= 0xEF) {
+			count = 3;
+			cp = c0 & 0x0F;
+			lo = c0 == 0xE0 ? 0xA0 : 0x80;
+			hi = c0 == 0xED ? 0x9F : 0xBF;
+		} else if (c0 >= 0xF0 && c0 <= 0xF4) {
+			count = 4;
+			cp = c0 & 0x07;
+			lo = c0 == 0xF0 ? 0x90 : 0x80;
+			hi = c0 == 0xF4 ? 0x8F : 0xBF;
+		} else {
+			return transcode_error::invalid;
+		}
+
+		for (size_t i = 1; i < count; ++i) {
+			if (first + i == last) {
+				return transcode_error::truncated;
+			}
+
+			const uint32_t c = unit_value(first[i]);
+			if (c < lo || c > hi) {
+				return transcode_error::invalid;
+			}
+			lo = 0x80;
+			hi = 0xBF;
+			cp = (cp << 6) | (c & 0x3F);
+		}
+
+		first += count;
+		return transcode_error::none;
+	}
+
+	static void count_classes(
+			const char* first, size_t size, size_t (&classes)[4]) {
+		// Continuation bytes are skipped, lead bytes give the length.
+		size_t ge[4];
+		count_at_least(first, size, { 0x80, 0xC0, 0xE0, 0xF0 }, ge);
+		classes[0] = size - ge[0];
+		classes[1] = ge[1] - ge[2];
+		classes[2] = ge[2] - ge[3];
+		classes[3] = ge[3];
+	}
+
+	static constexpr size_t size(char32_t cp) {
+		if (cp < 0x80) {
+			return 1;
+		}
+		if (cp < 0x800) {
+			return 2;
+		}
+		if (cp < 0x10000) {
+			return 3;
+		}
+		return 4;
+	}
+
+	static char* encode(char32_t cp, char* out) {
+		if (cp < 0x80) {
+			*out++ = char(cp);
+		} else if (cp < 0x800) {
+			*out++ = char(0xC0 | (cp >> 6));
+			*out++ = char(0x80 | (cp & 0x3F));
+		} else if (cp < 0x10000) {
+			*out++ = char(0xE0 | (cp >> 12));
+			*out++ = char(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = char(0x80 | (cp & 0x3F));
+		} else {
+			*out++ = char(0xF0 | (cp >> 18));
+			*out++ = char(0x80 | ((cp >> 12) & 0x3F));
+			*out++ = char(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = char(0x80 | (cp & 0x3F));
+		}
+		return out;
+	}
+};
+
+// UTF-16, stored in any unit type. Units over 0xFFFF are invalid.
+template <class CharT>
+struct utf16_codec {
+	using char_type = CharT;
+	static constexpr size_t cp_units[4] = { 1, 1, 1, 2 };
+	static constexpr uint32_t direct_max = 0xFFFF;
+
+	static transcode_error decode(
+			const CharT*& first, const CharT* last, char32_t& cp) {
+		const uint32_t u0 = unit_value(*first);
+		if (u0 < 0xD800 || (u0 > 0xDFFF && u0 <= 0xFFFF)) {
+			cp = u0;
+			++first;
+			return transcode_error::none;
+		}
+
+		// Lone low surrogate or out of range.
+		if (u0 > 0xDBFF) {
+			return transcode_error::invalid;
+		}
+
+		if (first + 1 == last) {
+			return transcode_error::truncated;
+		}
+
+		const uint32_t u1 = unit_value(first[1]);
+		if (u1 < 0xDC00 || u1 > 0xDFFF) {
+			return transcode_error::invalid;
+		}
+
+		cp = 0x10000 + ((u0 - 0xD800) << 10) + (u1 - 0xDC00);
+		first += 2;
+		return transcode_error::none;
+	}
+
+	static void count_classes(
+			const CharT* first, size_t size, size_t (&classes)[4]) {
+		// Surrogate pairs are counted once, by their high surrogate.
+		size_t ge[5];
+		count_at_least(
+				first, size, { 0x80, 0x800, 0xD800, 0xDC00, 0xE000 }, ge);
+		classes[0] = size - ge[0];
+		classes[1] = ge[0] - ge[1];
+		classes[2] = ge[1] - (ge[2] - ge[4]);
+		classes[3] = ge[2] - ge[3];
+	}
+
+	static constexpr size_t size(char32_t cp) {
+		return cp < 0x10000 ? 1 : 2;
+	}
+
+	static CharT* encode(char32_t cp, CharT* out) {
+		if (cp < 0x10000) {
+			*out++ = CharT(cp);
+		} else {
+			cp -= 0x10000;
+			*out++ = CharT(0xD800 + (cp >> 10));
+			*out++ = CharT(0xDC00 + (cp & 0x3FF));
+		}
+		return out;
+	}
+};
+
+// UCS-2, the outdated fixed-width subset of UTF-16. Can't store code points
+// over U+FFFF.
+template <class CharT>
+struct ucs2_codec {
+	using char_type = CharT;
+	static constexpr size_t cp_units[4] = { 1, 1, 1, 0 };
+	static constexpr uint32_t direct_max = 0xFFFF;
+
+	static transcode_error decode(
+			const CharT*& first, const CharT*, char32_t& cp) {
+		const uint32_t u = unit_value(*first);
+		if (u > 0xFFFF || (u >= 0xD800 && u <= 0xDFFF)) {
+			return transcode_error::invalid;
+		}
+
+		cp = u;
+		++first;
+		return transcode_error::none;
+	}
+
+	static void count_classes(
+			const CharT* first, size_t size, size_t (&classes)[4]) {
+		size_t ge[2];
+		count_at_least(first, size, { 0x80, 0x800 }, ge);
+		classes[0] = size - ge[0];
+		classes[1] = ge[0] - ge[1];
+		classes[2] = ge[1];
+		classes[3] = 0;
+	}
+
+	static constexpr size_t size(char32_t cp) {
+		return cp < 0x10000 ? 1 : 0;
+	}
+
+	static CharT* encode(char32_t cp, CharT* out) {
+		*out++ = CharT(cp);
+		return out;
+	}
+};
+
+template <class CharT>
+struct utf32_codec {
+	using char_type = CharT;
+	static constexpr size_t cp_units[4] = { 1, 1, 1, 1 };
+	static constexpr uint32_t direct_max = 0x10FFFF;
+
+	static transcode_error decode(
+			const CharT*& first, const CharT*, char32_t& cp) {
+		const uint32_t u = unit_value(*first);
+		if (u > 0x10FFFF || (u >= 0xD800 && u <= 0xDFFF)) {
+			return transcode_error::invalid;
+		}
+
+		cp = u;
+		++first;
+		return transcode_error::none;
+	}
+
+	static void count_classes(
+			const CharT* first, size_t size, size_t (&classes)[4]) {
+		size_t ge[3];
+		count_at_least(first, size, { 0x80, 0x800, 0x10000 }, ge);
+		classes[0] = size - ge[0];
+		classes[1] = ge[0] - ge[1];
+		classes[2] = ge[1] - ge[2];
+		classes[3] = ge[2];
+	}
+
+	static constexpr size_t size(char32_t) {
+		return 1;
+	}
+
+	static CharT* encode(char32_t cp, CharT* out) {
+		*out++ = CharT(cp);
+		return out;
+	}
+};
+
+// The most output units From can produce, per input unit.
+template <class From, class To>
+[[nodiscard]] constexpr size_t max_transcode_ratio() {
+	size_t ret = 1;
+	for (size_t i = 0; i < 4; ++i) {
+		const size_t from = From::cp_units[i];
+		const size_t to = To::cp_units[i];
+		if (from == 0 || to == 0) {
+			continue;
+		}
+		ret = std::max(ret, (to + from - 1) / from);
+	}
+	return ret;
+}
+
+// Copies the leading run of ascii units, converting the unit type.
+// Returns the number of units copied.
+template <class In, class Out>
+size_t copy_ascii(const In* first, size_t in_size, Out* out, size_t out_size) {
+	const size_t count = std::min(in_size, out_size);
+	size_t i = 0;
+
+#if defined(FEA_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	if constexpr (sizeof(In) == 1) {
+		for (; i + 16 <= count; i += 16) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			if (_mm_movemask_epi8(v) != 0) {
+				break;
+			}
+
+			__m128i* dst = reinterpret_cast<__m128i*>(out + i);
+			if constexpr (sizeof(Out) == 1) {
+				_mm_storeu_si128(dst, v);
+			} else if constexpr (sizeof(Out) == 2) {
+				_mm_storeu_si128(dst, _mm_unpacklo_epi8(v, zero));
+				_mm_storeu_si128(dst + 1, _mm_unpackhi_epi8(v, zero));
+			} else if constexpr (sizeof(Out) == 4) {
+				const __m128i lo = _mm_unpacklo_epi8(v, zero);
+				const __m128i hi = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+			}
+		}
+	} else if constexpr (sizeof(In) == 2) {
+		const __m128i mask = _mm_set1_epi16(int16_t(0xFF80));
+		for (; i + 8 <= count; i += 8) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			const __m128i high = _mm_and_si128(v, mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) {
+				break;
+			}
+
+			if constexpr (sizeof(Out) == 1) {
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+						_mm_packus_epi16(v, v));
+			} else if constexpr (sizeof(Out) == 2) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+			} else if constexpr (sizeof(Out) == 4) {
+				__m128i* dst = reinterpret_cast<__m128i*>(out + i);
+				_mm_storeu_si128(dst, _mm_unpacklo_epi16(v, zero));
+				_mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(v, zero));
+			}
+		}
+	} else if constexpr (sizeof(In) == 4) {
+		const __m128i mask = _mm_set1_epi32(int32_t(0xFFFFFF80));
+		for (; i + 4 <= count; i += 4) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			const __m128i high = _mm_and_si128(v, mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF) {
+				break;
+			}
+
+			if constexpr (sizeof(Out) == 1) {
+				const __m128i p16 = _mm_packs_epi32(v, v);
+				const __m128i p8 = _mm_packus_epi16(p16, p16);
+				const int32_t bytes = _mm_cvtsi128_si32(p8);
+				std::memcpy(out + i, &bytes, 4);
+			} else if constexpr (sizeof(Out) == 2) {
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+						_mm_packs_epi32(v, v));
+			} else if constexpr (sizeof(Out) == 4) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		const uint32_t u = unit_value(first[i]);
+		if (u >= 0x80) {
+			break;
+		}
+		out[i] = Out(u);
+	}
+	return i;
+}
+
+// Returns the length of the leading run of units which are a code point by
+// themselves : units up to Max, which aren't surrogates.
+template <uint32_t Max, class CharT>
+size_t direct_prefix(const CharT* first, size_t size) {
+	static_assert(sizeof(CharT) != 1 || Max == 0x7F,
+			"byte units are checked for ascii only");
+
+	size_t i = 0;
+
+#if defined(FEA_SSE2)
+	if constexpr (sizeof(CharT) == 1) {
+		for (; i + 16 <= size; i += 16) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			if (_mm_movemask_epi8(v) != 0) {
+				break;
+			}
+		}
+	} else if constexpr (sizeof(CharT) == 2) {
+		static_assert(Max == 0xFFFF, "16 bit units are checked for utf16");
+		const __m128i mask = _mm_set1_epi16(int16_t(0xF800));
+		const __m128i surrogate = _mm_set1_epi16(int16_t(0xD800));
+		for (; i + 8 <= size; i += 8) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			const __m128i bad
+					= _mm_cmpeq_epi16(_mm_and_si128(v, mask), surrogate);
+			if (_mm_movemask_epi8(bad) != 0) {
+				break;
+			}
+		}
+	} else if constexpr (sizeof(CharT) == 4) {
+		// No unsigned compares, flip the sign bits to compare signed.
+		const __m128i sign = _mm_set1_epi32(int32_t(0x80000000));
+		const __m128i max = _mm_set1_epi32(int32_t(Max ^ 0x80000000));
+		const __m128i mask = _mm_set1_epi32(int32_t(0xFFFFF800));
+		const __m128i surrogate = _mm_set1_epi32(0xD800);
+		for (; i + 4 <= size; i += 4) {
+			const __m128i v = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(first + i));
+			const __m128i over
+					= _mm_cmpgt_epi32(_mm_xor_si128(v, sign), max);
+			const __m128i surr
+					= _mm_cmpeq_epi32(_mm_and_si128(v, mask), surrogate);
+			if (_mm_movemask_epi8(_mm_or_si128(over, surr)) != 0) {
+				break;
+			}
+		}
+	}
+#endif
+
+	for (; i < size; ++i) {
+		const uint32_t u = unit_value(first[i]);
+		if (u > Max || (u >= 0xD800 && u <= 0xDFFF)) {
+			break;
+		}
+	}
+	return i;
+}
+
+// Converts [first, last) from one encoding to another, writing at most
+// out_size units. Stops at the first error.
+template <class From, class To>
+transcode_result basic_transcode(const typename From::char_type* first,
+		const typename From::char_type* last, typename To::char_type* out,
+		size_t out_size) noexcept {
+	const typename From::char_type* in = first;
+	typename To::char_type* o = out;
+	typename To::char_type* const o_end = out + out_size;
+
+	auto result = [&](transcode_error err) {
+		return transcode_result{ size_t(in - first), size_t(o - out), err };
+	};
+
+	while (in != last) {
+		const size_t ascii_count = copy_ascii(
+				in, size_t(last - in), o, size_t(o_end - o));
+		in += ascii_count;
+		o += ascii_count;
+		if (in == last) {
+			break;
+		}
+
+		const typename From::char_type* seq = in;
+		char32_t cp = 0;
+		const transcode_error err = From::decode(in, last, cp);
+		if (err != transcode_error::none) {
+			return result(err);
+		}
+
+		const size_t needed = To::size(cp);
+		if (needed == 0 || size_t(o_end - o) < needed) {
+			in = seq;
+			return result(needed == 0 ? transcode_error::unrepresentable
+									  : transcode_error::output_full);
+		}
+		o = To::encode(cp, o);
+	}
+
+	return result(transcode_error::none);
+}
+
+// The most units converting in_size units can produce. Size buffers with
+// this once and conversions never run out of room.
+template <class From, class To>
+[[nodiscard]] constexpr size_t max_transcoded_size(size_t in_size) noexcept {
+	return in_size * max_transcode_ratio<From, To>();
+}
+
+// The exact number of units converting the string produces, computed in a
+// cheap vectorized pass. When the input is invalid, it is still enough to
+// hold what converts before the error.
+template <class From, class To>
+[[nodiscard]] size_t transcoded_size(
+		std::basic_string_view<typename From::char_type> str) {
+	size_t classes[4];
+	From::count_classes(str.data(), str.size(), classes);
+
+	size_t ret = 0;
+	for (size_t i = 0; i < 4; ++i) {
+		ret += classes[i] * To::cp_units[i];
+	}
+	return ret;
+}
+
+// Output lengths, exact for valid input. Use them to size buffers.
+[[nodiscard]] inline size_t code_point_count(std::string_view str) {
+	return transcoded_size<utf8_codec, utf32_codec<char32_t>>(str);
+}
+[[nodiscard]] inline size_t code_point_count(std::u16string_view str) {
+	return transcoded_size<utf16_codec<char16_t>, utf32_codec<char32_t>>(
+			str);
+}
+[[nodiscard]] inline size_t code_point_count(std::u32string_view str) {
+	return str.size();
+}
+[[nodiscard]] inline size_t utf8_length_from_utf16(std::u16string_view str) {
+	return transcoded_size<utf16_codec<char16_t>, utf8_codec>(str);
+}
+[[nodiscard]] inline size_t utf8_length_from_utf32(std::u32string_view str) {
+	return transcoded_size<utf32_codec<char32_t>, utf8_codec>(str);
+}
+[[nodiscard]] inline size_t utf16_length_from_utf8(std::string_view str) {
+	return transcoded_size<utf8_codec, utf16_codec<char16_t>>(str);
+}
+[[nodiscard]] inline size_t utf16_length_from_utf32(
+		std::u32string_view str) {
+	return transcoded_size<utf32_codec<char32_t>, utf16_codec<char16_t>>(
+			str);
+}
+[[nodiscard]] inline size_t utf32_length_from_utf8(std::string_view str) {
+	return code_point_count(str);
+}
+[[nodiscard]] inline size_t utf32_length_from_utf16(std::u16string_view str) {
+	return code_point_count(str);
+}
+
+// Converts the string into your buffer, writing at most out_size units.
+// Never throws, check the result's error.
+template <class From, class To>
+transcode_result transcode_into(
+		std::basic_string_view<typename From::char_type> str,
+		typename To::char_type* out, size_t out_size) noexcept {
+	return basic_transcode<From, To>(
+			str.data(), str.data() + str.size(), out, out_size);
+}
+
+// Converts the string into out, reusing its memory. On error, out holds
+// what was converted up to the faulty sequence. Doesn't throw, except
+// std::bad_alloc if out must grow.
+template <class From, class To, class String>
+transcode_result transcode_into(
+		std::basic_string_view<typename From::char_type> str, String& out) {
+	out.resize(max_transcoded_size<From, To>(str.size()));
+	const transcode_result res = basic_transcode<From, To>(
+			str.data(), str.data() + str.size(), out.data(), out.size());
+	out.resize(res.written);
+	return res;
+}
+
+// Converts a stream chunk by chunk, in constant memory. Sequences split
+// across chunks are kept until the next feed. Call flush once the input is
+// done, to catch a truncated ending.
+// Chunks must be split on code unit boundaries.
+template <class From, class To>
+struct transcoder {
+	using in_char = typename From::char_type;
+	using out_char = typename To::char_type;
+
+	// Converts the chunk and appends the result to out.
+	// The result's consumed is relative to the chunk. After an error, reset
+	// before feeding more input.
+	// out grows by reserving, it is never zero-filled. Reserve the whole
+	// output up front to avoid reallocating.
+	template <class String>
+	transcode_result feed(std::basic_string_view<in_char> chunk, String& out) {
+		const size_t start = out.size();
+		out.reserve(start + max_transcoded_size<From, To>(chunk.size()));
+
+		// Blocks are converted on the stack, then appended.
+		out_char buf[max_transcoded_size<From, To>(block_size)];
+		size_t i = 0;
+
+		// Complete the sequence left by the previous chunk.
+		while (_pending_size != 0 && i < chunk.size()) {
+			_pending[_pending_size++] = chunk[i++];
+
+			const in_char* first = _pending;
+			char32_t cp = 0;
+			const transcode_error err
+					= From::decode(first, _pending + _pending_size, cp);
+			if (err == transcode_error::truncated
+					&& _pending_size < max_units) {
+				continue;
+			}
+			if (err != transcode_error::none) {
+				return { 0, 0, err };
+			}
+
+			const size_t needed = To::size(cp);
+			if (needed == 0) {
+				return { 0, 0, transcode_error::unrepresentable };
+			}
+			To::encode(cp, buf);
+			out.append(buf, needed);
+			_position += _pending_size;
+			_pending_size = 0;
+		}
+
+		const std::basic_string_view<in_char> rest = chunk.substr(i);
+		transcode_result res{};
+		while (res.consumed < rest.size()) {
+			const size_t n = std::min(block_size, rest.size() - res.consumed);
+			const in_char* first = rest.data() + res.consumed;
+			const transcode_result block = basic_transcode<From, To>(
+					first, first + n, buf, std::size(buf));
+			out.append(buf, block.written);
+			res.consumed += block.consumed;
+
+			// Sequences split between blocks are picked up by the next one.
+			const bool last_block = first + n == rest.data() + rest.size();
+			if (block.error != transcode_error::none
+					&& (block.error != transcode_error::truncated
+							|| last_block)) {
+				res.error = block.error;
+				break;
+			}
+		}
+		_position += res.consumed;
+
+		// Keep an incomplete ending for later.
+		if (res.error == transcode_error::truncated) {
+			_pending_size = rest.size() - res.consumed;
+			std::copy(rest.begin() + res.consumed, rest.end(), _pending);
+			res.consumed = rest.size();
+			res.error = transcode_error::none;
+		}
+
+		res.consumed += i;
+		res.written = out.size() - start;
+		return res;
+	}
+
+	// Ends the stream. Returns truncated if it stopped mid-sequence.
+	// The transcoder can then be reused.
+	transcode_error flush() {
+		const bool truncated = _pending_size != 0;
+		reset();
+		return truncated ? transcode_error::truncated : transcode_error::none;
+	}
+
+	void reset() {
+		_pending_size = 0;
+		_position = 0;
+	}
+
+	// Input units converted so far, over all chunks. On error, the index of
+	// the faulty sequence in the stream.
+	[[nodiscard]] size_t position() const {
+		return _position;
+	}
+
+	// Is a partial sequence waiting for the next chunk.
+	[[nodiscard]] bool has_pending() const {
+		return _pending_size != 0;
+	}
+
+private:
+	static constexpr size_t max_units = 4;
+	static constexpr size_t block_size = 1024;
+
+	in_char _pending[max_units]{};
+	size_t _pending_size{ 0 };
+	size_t _position{ 0 };
+};
+
+[[noreturn]] inline void throw_transcode_error(
+		const char* func_name, const transcode_result& res) {
+	const char* what = res.error == transcode_error::unrepresentable
+			? " : unrepresentable code point at index "
+			: " : invalid input at index ";
+	throw std::range_error{ std::string{ func_name } + what
+		+ std::to_string(res.consumed) };
+}
+
+// Converts the whole string, allocating once. Throws std::range_error on
+// invalid or unrepresentable input.
+template <class From, class To,
+		class String = std::basic_string<typename To::char_type>>
+[[nodiscard]] String transcode_string(
+		std::basic_string_view<typename From::char_type> str,
+		const char* func_name,
+		const typename String::allocator_type& alloc = {}) {
+	String ret(
+			transcoded_size<From, To>(str), typename To::char_type{}, alloc);
+
+	const transcode_result res = basic_transcode<From, To>(
+			str.data(), str.data() + str.size(), ret.data(), ret.size());
+	if (res.error != transcode_error::none) {
+		throw_transcode_error(func_name, res);
+	}
+
+	ret.resize(res.written);
+	return ret;
+}
+
+struct validate_result {
+	// Index of the first invalid sequence, or the input size when valid.
+	size_t offset = 0;
+	transcode_error error = transcode_error::none;
+
+	[[nodiscard]] constexpr bool valid() const {
+		return error == transcode_error::none;
+	}
+};
+
+// Checks [first, last) is well formed, without allocating. Runs of units
+// which are code points by themselves are skipped in blocks.
+template <class Codec>
+[[nodiscard]] validate_result basic_validate(
+		const typename Codec::char_type* first,
+		const typename Codec::char_type* last) {
+	const typename Codec::char_type* in = first;
+	while (in != last) {
+		in += direct_prefix<Codec::direct_max>(in, size_t(last - in));
+		if (in == last) {
+			break;
+		}
+
+		char32_t cp = 0;
+		const transcode_error err = Codec::decode(in, last, cp);
+		if (err != transcode_error::none) {
+			return { size_t(in - first), err };
+		}
+	}
+	return { size_t(last - first), transcode_error::none };
+}
+
+// Validation. Returns the offset of the first error, if any.
+[[nodiscard]] inline validate_result validate_utf8(std::string_view str) {
+	return basic_validate<utf8_codec>(str.data(), str.data() + str.size());
+}
+[[nodiscard]] inline validate_result validate_utf16(std::u16string_view str) {
+	return basic_validate<utf16_codec<char16_t>>(
+			str.data(), str.data() + str.size());
+}
+[[nodiscard]] inline validate_result validate_utf16(std::wstring_view str) {
+	return basic_validate<utf16_codec<wchar_t>>(
+			str.data(), str.data() + str.size());
+}
+[[nodiscard]] inline validate_result validate_utf32(std::u32string_view str) {
+	return basic_validate<utf32_codec<char32_t>>(
+			str.data(), str.data() + str.size());
+}
+[[nodiscard]] inline validate_result validate_ucs2(std::u16string_view str) {
+	return basic_validate<ucs2_codec<char16_t>>(
+			str.data(), str.data() + str.size());
+}
+[[nodiscard]] inline validate_result validate_ucs2(std::wstring_view str) {
+	return basic_validate<ucs2_codec<wchar_t>>(
+			str.data(), str.data() + str.size());
+}
+
+// The unicode encoding each character type stores. wchar_t is utf16 where
+// it is 16 bits wide (Windows), and utf32 elsewhere.
+template <class CharT>
+struct codec_of;
+template <>
+struct codec_of<char> {
+	using type = utf8_codec;
+};
+template <>
+struct codec_of<char16_t> {
+	using type = utf16_codec<char16_t>;
+};
+template <>
+struct codec_of<char32_t> {
+	using type = utf32_codec<char32_t>;
+};
+template <>
+struct codec_of<wchar_t> {
+	using type = std::conditional_t<sizeof(wchar_t) == 2,
+			utf16_codec<wchar_t>, utf32_codec<wchar_t>>;
+};
+template <class CharT>
+using codec_of_t = typename codec_of<CharT>::type;
+
+// Converts the string to the encoding of ToCharT, with the direct kernel
+// for the pair of types. The result is allocated once, with alloc.
+// Strings of the same encoding are validated, then copied as is.
+// Throws std::range_error on invalid input.
+template <class ToCharT, class FromCharT,
+		class Alloc = std::allocator<ToCharT>>
+[[nodiscard]] std::basic_string<ToCharT, std::char_traits<ToCharT>, Alloc>
+transcode(std::basic_string_view<FromCharT> str, const Alloc& alloc = {}) {
+	using string_t = std::basic_string<ToCharT, std::char_traits<ToCharT>,
+			Alloc>;
+	using from_codec = codec_of_t<FromCharT>;
+	using to_codec = codec_of_t<ToCharT>;
+
+	if constexpr (std::is_same_v<FromCharT, ToCharT>) {
+		const validate_result res = basic_validate<from_codec>(
+				str.data(), str.data() + str.size());
+		if (!res.valid()) {
+			throw_transcode_error(
+					"transcode", transcode_result{ res.offset, 0, res.error });
+		}
+		return string_t{ str.begin(), str.end(), alloc };
+	} else {
+		return transcode_string<from_codec, to_codec, string_t>(
+				str, "transcode", alloc);
+	}
+}
+
+template <class ToCharT, class FromCharT, class Traits, class FromAlloc,
+		class Alloc = std::allocator<ToCharT>>
+[[nodiscard]] std::basic_string<ToCharT, std::char_traits<ToCharT>, Alloc>
+transcode(const std::basic_string<FromCharT, Traits, FromAlloc>& str,
+		const Alloc& alloc = {}) {
+	return transcode<ToCharT>(
+			std::basic_string_view<FromCharT>{ str.data(), str.size() },
+			alloc);
+}
+
+template <class ToCharT, class FromCharT,
+		class Alloc = std::allocator<ToCharT>>
+[[nodiscard]] std::basic_string<ToCharT, std::char_traits<ToCharT>, Alloc>
+transcode(const FromCharT* str, const Alloc& alloc = {}) {
+	return transcode<ToCharT>(std::basic_string_view<FromCharT>{ str }, alloc);
+}
+
+// Reads count units from raw bytes stored in the given byte order.
+template <class CharT>
+void load_units(
+		const char* bytes, size_t count, bool big_endian, CharT* out) {
+	static_assert(sizeof(CharT) == 2 || sizeof(CharT) == 4,
+			"units must be 16 or 32 bits");
+	const uint8_t* src = reinterpret_cast<const uint8_t*>(bytes);
+	size_t i = 0;
+
+#if defined(FEA_SSE2)
+	// x86 is little endian.
+	if (!big_endian) {
+		std::memcpy(out, src, count * sizeof(CharT));
+		return;
+	}
+
+	constexpr size_t per_block = 16 / sizeof(CharT);
+	for (; i + per_block <= count; i += per_block) {
+		__m128i v = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(src + i * sizeof(CharT)));
+		if constexpr (sizeof(CharT) == 4) {
+			// Swap the 16 bit halves, then the bytes.
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		const uint8_t* b = src + i * sizeof(CharT);
+		uint32_t u = 0;
+		for (size_t j = 0; j < sizeof(CharT); ++j) {
+			const size_t shift = big_endian ? sizeof(CharT) - 1 - j : j;
+			u |= uint32_t(b[j]) << (shift * 8);
+		}
+		out[i] = CharT(u);
+	}
+}
+
+// Reads units from raw bytes and validates them in the same pass. The bytes
+// are processed in blocks, which are checked while still in cache.
+// Output must hold bytes.size() / sizeof(char_type) units.
+template <class Codec>
+validate_result load_and_validate(std::string_view bytes, bool big_endian,
+		typename Codec::char_type* out) {
+	using char_type = typename Codec::char_type;
+	constexpr size_t block_size = 4096 / sizeof(char_type);
+
+	const size_t count = bytes.size() / sizeof(char_type);
+	const char_type* checked = out;
+	for (size_t i = 0; i < count; i += block_size) {
+		const size_t n = std::min(block_size, count - i);
+		load_units(bytes.data() + i * sizeof(char_type), n, big_endian,
+				out + i);
+
+		const char_type* last = out + i + n;
+		const bool done = i + n == count;
+		while (checked != last) {
+			checked += direct_prefix<Codec::direct_max>(
+					checked, size_t(last - checked));
+			if (checked == last) {
+				break;
+			}
+
+			// A sequence straddling blocks is checked with the next one.
+			char32_t cp = 0;
+			const transcode_error err = Codec::decode(checked, last, cp);
+			if (err == transcode_error::truncated && !done) {
+				break;
+			}
+			if (err != transcode_error::none) {
+				return { size_t(checked - out), err };
+			}
+		}
+	}
+	return { count, transcode_error::none };
+}
+} // namespace fea
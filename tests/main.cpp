@@ -2,6 +2,7 @@
 #include <cstring>
 #include <fea_utils/fea_utils.hpp>
 #include <gtest/gtest.h>
+#include <memory_resource>
 
 namespace {
 std::filesystem::path exe_path;
@@ -38,6 +39,551 @@ TEST(str, basics) {
 	EXPECT_EQ(capscpy, "is SCREAMING");
 }
 
+TEST(str, predicates) {
+	const std::string str = "a string";
+	EXPECT_TRUE(fea::starts_with(str, "a s"));
+	EXPECT_TRUE(fea::starts_with(str, std::string_view{ "" }));
+	EXPECT_FALSE(fea::starts_with(str, "string"));
+	EXPECT_FALSE(fea::starts_with("a", str));
+	EXPECT_TRUE(fea::ends_with(str, "ring"));
+	EXPECT_TRUE(fea::ends_with(str, str));
+	EXPECT_FALSE(fea::ends_with(str, "a"));
+	EXPECT_FALSE(fea::ends_with("g", str));
+	EXPECT_FALSE(fea::ends_with(std::string{ "ab" }, std::string{ "bb" }));
+	EXPECT_TRUE(fea::contains(std::wstring_view{ L"a string" }, L"str"));
+	EXPECT_TRUE(fea::equals(str, "a string"));
+	EXPECT_FALSE(fea::equals(str, "a strin"));
+	EXPECT_LT(fea::compare("abc", "abd"), 0);
+	EXPECT_GT(fea::compare(u"b", std::u16string{ u"abc" }), 0);
+	EXPECT_EQ(fea::compare(U"", std::u32string_view{}), 0);
+
+	static_assert(fea::starts_with(std::string_view{ "constexpr" }, "const"));
+	static_assert(fea::ends_with("constexpr", "expr"));
+	static_assert(fea::contains("constexpr", "ste"));
+	static_assert(!fea::equals("a", "b"));
+
+	// Non-strings drop out of overload resolution.
+	auto call_contains = [](const auto& a, const auto& b)
+			-> decltype(fea::contains(a, b)) { return fea::contains(a, b); };
+	auto call_compare = [](const auto& a, const auto& b)
+			-> decltype(fea::compare(a, b)) { return fea::compare(a, b); };
+	static_assert(std::is_invocable_v<decltype(call_contains), std::string,
+			const char*>);
+	static_assert(!std::is_invocable_v<decltype(call_contains), int, int>);
+	static_assert(!std::is_invocable_v<decltype(call_compare),
+			std::vector<int>, std::string>);
+}
+
+TEST(str, split_view) {
+	auto collect = [](auto&& view) {
+		std::vector<std::string> ret;
+		for (std::string_view token : view) {
+			ret.emplace_back(token);
+		}
+		return ret;
+	};
+	using vec = std::vector<std::string>;
+
+	const std::string str = ",a,,b, c,";
+	EXPECT_EQ(collect(fea::split_view(str, ',')), (vec{ "a", "b", " c" }));
+	EXPECT_EQ(collect(fea::split_view(str, ", ")), (vec{ "a", "b", "c" }));
+
+	fea::split_options opts;
+	opts.keep_empty = true;
+	EXPECT_EQ(collect(fea::split_view(str, ',', opts)),
+			(vec{ "", "a", "", "b", " c", "" }));
+	EXPECT_EQ(collect(fea::split_view(std::string_view{}, ',', opts)),
+			(vec{ "" }));
+	EXPECT_TRUE(collect(fea::split_view(std::string_view{}, ',')).empty());
+
+	opts.max_splits = 2;
+	EXPECT_EQ(collect(fea::split_view(str, ',', opts)),
+			(vec{ "", "a", ",b, c," }));
+	opts.keep_empty = false;
+	EXPECT_EQ(collect(fea::split_view(str, ',', opts)),
+			(vec{ "a", "b", " c," }));
+
+	fea::split_options seq;
+	seq.delimiter = fea::split_delimiter::sequence;
+	EXPECT_EQ(collect(fea::split_view("a::b:c::::d", "::", seq)),
+			(vec{ "a", "b:c", "d" }));
+	EXPECT_EQ(collect(fea::split_view("a::b", "", seq)), (vec{ "a::b" }));
+
+	// Only the tokens looked at are found.
+	auto view = fea::split_view(std::wstring_view{ L"x y z" }, L' ');
+	auto it = view.begin();
+	EXPECT_EQ(*it, L"x");
+	EXPECT_EQ(*++it, L"y");
+	EXPECT_EQ(std::distance(view.begin(), view.end()), 3);
+}
+
+TEST(str, char_set) {
+	// Every byte value, in a long enough string for the vectorized paths.
+	std::string str;
+	for (size_t i = 0; i < 3; ++i) {
+		for (size_t j = 0; j < 256; ++j) {
+			str.push_back(char((j * 7 + i) % 256));
+		}
+	}
+
+	// Small sets, large sets and high bytes take different paths.
+	const std::string sets[] = { ",", ",;\t\n", "\x80\xFF\x7F",
+		"abcdefghijklmnopqrstuvwxyz\xE9", "" };
+	for (const std::string& chars : sets) {
+		const fea::char_set set{ chars };
+		EXPECT_EQ(set.size(), chars.size());
+		for (size_t pos = 0; pos < 40; ++pos) {
+			EXPECT_EQ(set.find_first_of(str, pos),
+					str.find_first_of(chars, pos));
+			EXPECT_EQ(set.find_first_not_of(str, pos),
+					str.find_first_not_of(chars, pos));
+		}
+		EXPECT_EQ(set.find_last_not_of(str), str.find_last_not_of(chars));
+
+		size_t count = 0;
+		for (char c : str) {
+			count += chars.find(c) != std::string::npos;
+		}
+		EXPECT_EQ(set.count(str), count);
+	}
+
+	EXPECT_EQ(fea::trim("  \t a b \r\n"), "a b");
+	EXPECT_EQ(fea::trim_left("  a "), "a ");
+	EXPECT_EQ(fea::trim_right("  a "), "  a");
+	EXPECT_EQ(fea::trim(" \n "), "");
+	EXPECT_EQ(fea::trim("--a-", fea::char_set{ "-" }), "a");
+
+	using vec = std::vector<std::string>;
+	EXPECT_EQ(fea::split(std::string{ "a,b;;c" }, ",;"), (vec{ "a", "b", "c" }));
+}
+
+TEST(str, replace_all) {
+	const std::string str = "a.b..c...";
+	EXPECT_EQ(fea::replace_all(str, "..", "-"), "a.b-c-.");
+	EXPECT_EQ(fea::replace_all(str, ".", "<>"), "a<>b<><>c<><><>");
+	EXPECT_EQ(fea::replace_all(str, "", "x"), str);
+	EXPECT_EQ(fea::replace_all(str, "z", "x"), str);
+	EXPECT_EQ(fea::replace_all(std::string{ "aaa" }, "aa", "a"), "aa");
+
+	// Shrinking replacements are compacted in place.
+	std::string inplace = str;
+	inplace.reserve(64);
+	const char* mem = inplace.data();
+	fea::replace_all(inplace, "..", "", true);
+	EXPECT_EQ(inplace, "a.bc.");
+	EXPECT_EQ(inplace.data(), mem);
+
+	// Growing ones used to search the replaced text again.
+	inplace = "a";
+	fea::replace_all(inplace, "a", "aa", true);
+	EXPECT_EQ(inplace, "aa");
+
+	std::wstring wide = L"x+y";
+	fea::replace_all(wide, L"+", L" plus ", true);
+	EXPECT_EQ(wide, L"x plus y");
+
+	// Many patterns, in one pass.
+	const std::string html = "<a href=\"x\">&</a>";
+	EXPECT_EQ(fea::replace_all(html,
+					  { { "&", "&amp;" }, { "<", "&lt;" }, { ">", "&gt;" },
+							  { "\"", "&quot;" } }),
+			"&lt;a href=&quot;x&quot;&gt;&amp;&lt;/a&gt;");
+
+	// Earlier patterns win, replaced text isn't searched again.
+	EXPECT_EQ(fea::replace_all(std::string{ "abcab" },
+					  { { "ab", "b" }, { "abc", "x" }, { "b", "ab" } }),
+			"bcb");
+	EXPECT_EQ(fea::replace_all(std::string{ "abc" }, { { "", "x" } }), "abc");
+
+	inplace = "{name} is {age}";
+	fea::replace_all(inplace, { { "{name}", "Bob" }, { "{age}", "42" } }, true);
+	EXPECT_EQ(inplace, "Bob is 42");
+
+	const fea::wreplacer rep{ { L"\u00e9", L"e" }, { L"\u0100", L"A" } };
+	EXPECT_EQ(rep.replace(L"\u00e9t\u00e9 \u0100"), L"ete A");
+}
+
+TEST(str, multi_searcher) {
+	const fea::multi_searcher searcher{ "he", "she", "his", "hers", "", "he" };
+	EXPECT_EQ(searcher.size(), 6u);
+
+	const std::string text = std::string(40, '.') + "ushers";
+	EXPECT_TRUE(searcher.contains_any(text));
+	EXPECT_FALSE(searcher.contains_any(std::string(100, 'h')));
+	EXPECT_FALSE(searcher.contains_any(""));
+	EXPECT_EQ(searcher.find_needles(text), (std::vector<size_t>{ 0, 1, 3, 5 }));
+
+	// Overlapping matches, in the order they end.
+	std::vector<std::pair<size_t, size_t>> found;
+	for (const fea::multi_match& m : searcher.find_all(text)) {
+		found.push_back({ m.needle, m.position });
+	}
+	EXPECT_EQ(found,
+			(std::vector<std::pair<size_t, size_t>>{
+					{ 1, 41 }, { 5, 42 }, { 0, 42 }, { 3, 42 } }));
+
+	// Agrees with contains, needle by needle.
+	const std::vector<std::string> needles{ "ab", "bab", "b", "abba", "cab" };
+	const fea::multi_searcher from_range{ needles.begin(), needles.end() };
+	const std::string hay = "xxcabbabbaxx";
+	std::vector<size_t> expected;
+	for (size_t i = 0; i < needles.size(); ++i) {
+		if (fea::contains(hay, needles[i])) {
+			expected.push_back(i);
+		}
+	}
+	EXPECT_EQ(from_range.find_needles(hay), expected);
+
+	size_t count = 0;
+	from_range.find_all(hay, [&](size_t needle, size_t pos) {
+		EXPECT_EQ(hay.compare(pos, needles[needle].size(), needles[needle]),
+				0);
+		++count;
+	});
+	EXPECT_EQ(count, 10u);
+
+	const fea::wmulti_searcher wide{ L"\u6f22\u5b57", L"\u00e9t\u00e9" };
+	EXPECT_TRUE(wide.contains_any(L"un \u00e9t\u00e9 chaud"));
+	EXPECT_EQ(wide.find_needles(L"\u6f22\u5b57 \u6f22"),
+			(std::vector<size_t>{ 0 }));
+	EXPECT_FALSE(wide.contains_any(L"\u6f22 \u5b57"));
+
+	const fea::multi_searcher empty;
+	EXPECT_FALSE(empty.contains_any(text));
+}
+
+TEST(str, utf_conversions) {
+	// Long enough to go through the ascii fast path, with every utf8 length.
+	const std::string ascii(100, 'a');
+	const std::string utf8 = ascii + u8"\u00e9\u6f22\U0001F600" + ascii;
+	const std::u16string utf16 = std::u16string(100, u'a')
+			+ u"\u00e9\u6f22\U0001F600" + std::u16string(100, u'a');
+	const std::u32string utf32 = std::u32string(100, U'a')
+			+ U"\u00e9\u6f22\U0001F600" + std::u32string(100, U'a');
+	const std::wstring wutf16{ utf16.begin(), utf16.end() };
+	const std::u32string utf16_32bits{ utf16.begin(), utf16.end() };
+
+	EXPECT_EQ(fea::utf8_to_utf16(utf8), utf16);
+	EXPECT_EQ(fea::utf8_to_utf16_w(utf8), wutf16);
+	EXPECT_EQ(fea::utf8_to_utf16_32bits(utf8), utf16_32bits);
+	EXPECT_EQ(fea::utf8_to_utf32(utf8), utf32);
+	EXPECT_EQ(fea::utf16_to_utf8(utf16), utf8);
+	EXPECT_EQ(fea::utf16_to_utf8(wutf16), utf8);
+	EXPECT_EQ(fea::utf16_to_utf8(utf16_32bits), utf8);
+	EXPECT_EQ(fea::utf32_to_utf8(utf32), utf8);
+
+	const std::string bmp = ascii + u8"\u00e9\u6f22" + ascii;
+	const std::u16string ucs2 = std::u16string(100, u'a') + u"\u00e9\u6f22"
+			+ std::u16string(100, u'a');
+	const std::wstring wucs2{ ucs2.begin(), ucs2.end() };
+	EXPECT_EQ(fea::utf8_to_ucs2(bmp), ucs2);
+	EXPECT_EQ(fea::utf8_to_ucs2_w(bmp), wucs2);
+	EXPECT_EQ(fea::ucs2_to_utf8(ucs2), bmp);
+	EXPECT_EQ(fea::ucs2_to_utf8(wucs2), bmp);
+
+	// Direct conversions, without going through utf8.
+	EXPECT_EQ(fea::utf16_to_utf32(utf16), utf32);
+	EXPECT_EQ(fea::utf16_to_utf32(wutf16), utf32);
+	EXPECT_EQ(fea::utf32_to_utf16(utf32), utf16);
+	EXPECT_EQ(fea::utf32_to_utf16_w(utf32), wutf16);
+	EXPECT_EQ(fea::utf32_to_utf16_32bit(utf32), utf16_32bits);
+
+	const std::u32string bmp32{ ucs2.begin(), ucs2.end() };
+	EXPECT_EQ(fea::utf16_to_ucs2(ucs2), ucs2);
+	EXPECT_EQ(fea::utf16_to_ucs2(wucs2), ucs2);
+	EXPECT_EQ(fea::utf16_to_ucs2_w(ucs2), wucs2);
+	EXPECT_EQ(fea::utf16_to_ucs2_w(wucs2), wucs2);
+	EXPECT_EQ(fea::ucs2_to_utf16(ucs2), ucs2);
+	EXPECT_EQ(fea::ucs2_to_utf16(wucs2), ucs2);
+	EXPECT_EQ(fea::ucs2_to_utf16_w(ucs2), wucs2);
+	EXPECT_EQ(fea::ucs2_to_utf16_w(wucs2), wucs2);
+	EXPECT_EQ(fea::ucs2_to_utf16_32bit(ucs2), bmp32);
+	EXPECT_EQ(fea::ucs2_to_utf16_32bit(wucs2), bmp32);
+	EXPECT_EQ(fea::ucs2_to_utf32(ucs2), bmp32);
+	EXPECT_EQ(fea::ucs2_to_utf32(wucs2), bmp32);
+	EXPECT_EQ(fea::utf32_to_ucs2(bmp32), ucs2);
+	EXPECT_EQ(fea::utf32_to_ucs2_w(bmp32), wucs2);
+	EXPECT_THROW(fea::utf16_to_ucs2(utf16), std::range_error);
+	EXPECT_THROW(fea::utf32_to_ucs2(utf32), std::range_error);
+
+	EXPECT_EQ(fea::utf8_to_utf32(""), U"");
+	EXPECT_EQ(fea::utf32_to_utf8(U""), "");
+
+	// Invalid input.
+	EXPECT_THROW(fea::utf8_to_ucs2(utf8), std::range_error);
+	EXPECT_THROW(fea::utf8_to_utf32("a\xC0\xAF"), std::range_error);
+	EXPECT_THROW(fea::utf8_to_utf32("a\xED\xA0\x80"), std::range_error);
+	EXPECT_THROW(fea::utf8_to_utf32("a\xF4\x90\x80\x80"), std::range_error);
+	EXPECT_THROW(fea::utf8_to_utf16("a\xE6\xBC"), std::range_error);
+	EXPECT_THROW(fea::utf16_to_utf8(std::u16string{ u'a', char16_t(0xD800) }),
+			std::range_error);
+	EXPECT_THROW(fea::utf16_to_utf8(std::u16string{ char16_t(0xDC00), u'a' }),
+			std::range_error);
+	EXPECT_THROW(fea::utf32_to_utf8(std::u32string{ char32_t(0x110000) }),
+			std::range_error);
+	EXPECT_THROW(fea::ucs2_to_utf8(std::u16string{ char16_t(0xD800) }),
+			std::range_error);
+}
+
+TEST(str, length_counters) {
+	std::u32string utf32;
+	for (size_t i = 0; i < 10; ++i) {
+		utf32 += U"ab\u00e9\u07ff\u0800\u6f22\uffff\U00010000\U0001F600";
+		utf32 += std::u32string(i, U'z');
+	}
+	const std::string utf8 = fea::utf32_to_utf8(utf32);
+	const std::u16string utf16 = fea::utf32_to_utf16(utf32);
+
+	EXPECT_EQ(fea::code_point_count(utf8), utf32.size());
+	EXPECT_EQ(fea::code_point_count(utf16), utf32.size());
+	EXPECT_EQ(fea::code_point_count(utf32), utf32.size());
+	EXPECT_EQ(fea::utf8_length_from_utf16(utf16), utf8.size());
+	EXPECT_EQ(fea::utf8_length_from_utf32(utf32), utf8.size());
+	EXPECT_EQ(fea::utf16_length_from_utf8(utf8), utf16.size());
+	EXPECT_EQ(fea::utf16_length_from_utf32(utf32), utf16.size());
+	EXPECT_EQ(fea::utf32_length_from_utf8(utf8), utf32.size());
+	EXPECT_EQ(fea::utf32_length_from_utf16(utf16), utf32.size());
+	EXPECT_EQ(fea::code_point_count(""), 0u);
+
+	EXPECT_EQ(fea::iso_8859_1_to_utf8("a\xE9\xFF"), u8"a\u00e9\u00ff");
+}
+
+TEST(str, validate) {
+	const std::string ascii(100, 'a');
+	const std::string utf8 = ascii + u8"\u00e9\u6f22\U0001F600" + ascii;
+	const std::u16string utf16 = std::u16string(100, u'a')
+			+ u"\u00e9\u6f22\U0001F600" + std::u16string(100, u'a');
+	const std::u32string utf32 = std::u32string(100, U'a')
+			+ U"\u00e9\u6f22\U0001F600" + std::u32string(100, U'a');
+
+	EXPECT_TRUE(fea::validate_utf8(utf8).valid());
+	EXPECT_EQ(fea::validate_utf8(utf8).offset, utf8.size());
+	EXPECT_TRUE(fea::validate_utf16(utf16).valid());
+	EXPECT_TRUE(fea::validate_utf16(
+			std::wstring{ utf16.begin(), utf16.end() })
+						.valid());
+	EXPECT_TRUE(fea::validate_utf32(utf32).valid());
+	EXPECT_TRUE(fea::validate_utf8("").valid());
+	EXPECT_FALSE(fea::validate_ucs2(utf16).valid());
+
+	{
+		std::string bad = utf8;
+		bad[150] = '\xC0';
+		fea::validate_result res = fea::validate_utf8(bad);
+		EXPECT_EQ(res.error, fea::transcode_error::invalid);
+		EXPECT_EQ(res.offset, 150u);
+
+		res = fea::validate_utf8(utf8.substr(0, 104));
+		EXPECT_EQ(res.error, fea::transcode_error::truncated);
+		EXPECT_EQ(res.offset, 102u);
+	}
+	{
+		std::u16string bad = utf16;
+		bad[150] = char16_t(0xDC00);
+		fea::validate_result res = fea::validate_utf16(bad);
+		EXPECT_EQ(res.error, fea::transcode_error::invalid);
+		EXPECT_EQ(res.offset, 150u);
+	}
+	{
+		std::u32string bad = utf32;
+		bad[150] = char32_t(0x110000);
+		EXPECT_EQ(fea::validate_utf32(bad).offset, 150u);
+		bad[150] = char32_t(0xD800);
+		EXPECT_EQ(fea::validate_utf32(bad).offset, 150u);
+		bad[150] = char32_t(0xFFFFFFFF);
+		EXPECT_EQ(fea::validate_utf32(bad).offset, 150u);
+	}
+}
+
+TEST(str, transcode_into) {
+	using utf8 = fea::utf8_codec;
+	using utf16 = fea::utf16_codec<char16_t>;
+	using ucs2 = fea::ucs2_codec<char16_t>;
+
+	const std::string in = u8"abc\u00e9\U0001F600";
+	const std::u16string expected = u"abc\u00e9\U0001F600";
+	EXPECT_EQ((fea::max_transcoded_size<utf8, utf16>(in.size())), in.size());
+
+	char16_t buf[16];
+	fea::transcode_result res = fea::transcode_into<utf8, utf16>(in, buf, 16);
+	EXPECT_EQ(res.error, fea::transcode_error::none);
+	EXPECT_EQ(res.consumed, in.size());
+	EXPECT_EQ(std::u16string(buf, res.written), expected);
+
+	// Stops before a sequence which doesn't fit.
+	res = fea::transcode_into<utf8, utf16>(in, buf, 5);
+	EXPECT_EQ(res.error, fea::transcode_error::output_full);
+	EXPECT_EQ(res.consumed, 5u);
+	EXPECT_EQ(res.written, 4u);
+
+	// Reuses the string.
+	std::u16string out;
+	out.reserve(64);
+	const char16_t* mem = out.data();
+	res = fea::transcode_into<utf8, utf16>(in, out);
+	EXPECT_EQ(out, expected);
+	EXPECT_EQ(out.data(), mem);
+
+	res = fea::transcode_into<utf8, ucs2>(in, out);
+	EXPECT_EQ(res.error, fea::transcode_error::unrepresentable);
+	EXPECT_EQ(res.consumed, 5u);
+	EXPECT_EQ(out, u"abc\u00e9");
+
+	res = fea::transcode_into<utf8, utf16>(std::string_view{ "ab\xFF" }, out);
+	EXPECT_EQ(res.error, fea::transcode_error::invalid);
+	EXPECT_EQ(res.consumed, 2u);
+	EXPECT_EQ(out, u"ab");
+}
+
+TEST(str, transcoder) {
+	const std::string ascii(40, 'a');
+	const std::string utf8 = ascii + u8"\u00e9\u6f22\U0001F600" + ascii;
+	const std::u16string utf16 = std::u16string(40, u'a')
+			+ u"\u00e9\u6f22\U0001F600" + std::u16string(40, u'a');
+
+	// Every chunk size splits sequences differently.
+	for (size_t chunk_size = 1; chunk_size < 8; ++chunk_size) {
+		fea::transcoder<fea::utf8_codec, fea::utf16_codec<char16_t>> tc;
+		std::u16string out;
+		for (size_t i = 0; i < utf8.size(); i += chunk_size) {
+			fea::transcode_result res
+					= tc.feed(std::string_view{ utf8 }.substr(i, chunk_size),
+							out);
+			EXPECT_EQ(res.error, fea::transcode_error::none);
+		}
+		EXPECT_EQ(tc.flush(), fea::transcode_error::none);
+		EXPECT_EQ(out, utf16);
+
+		fea::transcoder<fea::utf16_codec<char16_t>, fea::utf8_codec> back;
+		std::string out8;
+		for (size_t i = 0; i < utf16.size(); i += chunk_size) {
+			back.feed(std::u16string_view{ utf16 }.substr(i, chunk_size), out8);
+		}
+		EXPECT_EQ(back.flush(), fea::transcode_error::none);
+		EXPECT_EQ(out8, utf8);
+	}
+
+	fea::transcoder<fea::utf8_codec, fea::utf32_codec<char32_t>> tc;
+	std::u32string out;
+	tc.feed(std::string_view{ "ab\xE6\xBC" }, out);
+	EXPECT_TRUE(tc.has_pending());
+	EXPECT_EQ(tc.position(), 2u);
+	EXPECT_EQ(tc.flush(), fea::transcode_error::truncated);
+	EXPECT_EQ(out, U"ab");
+
+	// Errors report their position in the stream.
+	out.clear();
+	tc.feed(std::string_view{ "ab\xE6" }, out);
+	fea::transcode_result res = tc.feed(std::string_view{ "\xBCz" }, out);
+	EXPECT_EQ(res.error, fea::transcode_error::invalid);
+	EXPECT_EQ(tc.position(), 2u);
+
+	// Large chunks are converted in blocks, sequences may straddle them.
+	tc.reset();
+	out.clear();
+	std::string big(1023, 'a');
+	big += "\xE6\xBC\xA2";
+	big += std::string(2000, 'b');
+	res = tc.feed(std::string_view{ big }, out);
+	EXPECT_EQ(res.error, fea::transcode_error::none);
+	EXPECT_EQ(res.consumed, big.size());
+	EXPECT_EQ(res.written, 1023u + 1u + 2000u);
+	EXPECT_EQ(out[1023], U'\u6f22');
+	EXPECT_EQ(tc.flush(), fea::transcode_error::none);
+
+	out.clear();
+	big[1500] = '\xFF';
+	res = tc.feed(std::string_view{ big }, out);
+	EXPECT_EQ(res.error, fea::transcode_error::invalid);
+	EXPECT_EQ(tc.position(), 1500u);
+	EXPECT_EQ(out.size(), 1023u + 1u + (1500u - 1026u));
+}
+
+TEST(str, transcode) {
+	const std::string utf8 = u8"abc\u00e9\u6f22\U0001F600";
+	const std::u16string utf16 = u"abc\u00e9\u6f22\U0001F600";
+	const std::u32string utf32 = U"abc\u00e9\u6f22\U0001F600";
+
+	EXPECT_EQ(fea::transcode<char16_t>(std::string_view{ utf8 }), utf16);
+	EXPECT_EQ(fea::transcode<char32_t>(utf16), utf32);
+	EXPECT_EQ(fea::transcode<char>(utf32), utf8);
+	EXPECT_EQ(fea::transcode<char>(utf8), utf8);
+	EXPECT_EQ(fea::transcode<char32_t>(u8"\u00e9"), U"\u00e9");
+
+	// wchar_t goes through its native encoding.
+	const std::wstring wide = fea::transcode<wchar_t>(utf8);
+	EXPECT_EQ(wide, L"abc\u00e9\u6f22\U0001F600");
+	EXPECT_EQ(fea::transcode<char32_t>(wide), utf32);
+	EXPECT_EQ(fea::utf32_to_any<char16_t>(utf32), utf16);
+
+	// The generalized conversions keep utf16 in wstrings everywhere.
+	const std::wstring wide16 = fea::utf8_to_utf16_w(utf8);
+	EXPECT_EQ(fea::utf8_to_any<wchar_t>(utf8), wide16);
+	EXPECT_EQ(fea::utf32_to_any<wchar_t>(utf32), wide16);
+	EXPECT_EQ(fea::any_to_utf8(wide16), utf8);
+	EXPECT_EQ(fea::any_to_utf32(wide16), utf32);
+
+	// Results use the given allocator.
+	char buf[256];
+	std::pmr::monotonic_buffer_resource res{ buf, sizeof(buf) };
+	std::pmr::u16string pmr_str = fea::transcode<char16_t>(
+			utf8, std::pmr::polymorphic_allocator<char16_t>{ &res });
+	EXPECT_EQ(pmr_str.get_allocator().resource(), &res);
+	EXPECT_EQ(std::u16string_view{ pmr_str }, std::u16string_view{ utf16 });
+
+	EXPECT_THROW(fea::transcode<char16_t>("ab\xFF"), std::range_error);
+
+	// Same type input is validated too.
+	EXPECT_THROW(fea::transcode<char>(std::string{ "ab\xFF" }),
+			std::range_error);
+	EXPECT_THROW(fea::transcode<char16_t>(std::u16string{ char16_t(0xD800) }),
+			std::range_error);
+	EXPECT_THROW(fea::transcode<char32_t>(std::u32string{ char32_t(0x110000) }),
+			std::range_error);
+}
+
+TEST(str, codepages) {
+	// Long enough to go through the ascii fast path.
+	const std::string ascii(40, 'a');
+	EXPECT_EQ(fea::codepage_to_utf8(fea::codepage::windows_1252,
+					  ascii + "\x80\xE9" + ascii),
+			ascii + u8"\u20ac\u00e9" + ascii);
+	EXPECT_EQ(fea::codepage_to_utf8(fea::codepage::iso_8859_15, "\xA4"),
+			u8"\u20ac");
+	EXPECT_EQ(fea::codepage_to_utf8(fea::codepage::cp437, "\xB0\xE1"),
+			u8"\u2591\u00df");
+	EXPECT_EQ(fea::codepage_to_utf16(fea::codepage::windows_1251, "\xC0\xFF"),
+			u"\u0410\u044f");
+	EXPECT_EQ(fea::codepage_to_utf16_w(fea::codepage::iso_8859_2, "\xA1"),
+			L"\u0104");
+
+	EXPECT_EQ(fea::utf8_to_codepage(fea::codepage::windows_1252,
+					  ascii + u8"\u20ac\u00e9" + ascii),
+			ascii + "\x80\xE9" + ascii);
+	EXPECT_EQ(fea::utf16_to_codepage(fea::codepage::windows_1250, u"\u0160"),
+			"\x8A");
+	EXPECT_EQ(fea::utf16_to_codepage(fea::codepage::cp437, L"\u2591"), "\xB0");
+	EXPECT_THROW(fea::utf8_to_codepage(fea::codepage::windows_1252, u8"\u6f22"),
+			std::range_error);
+	EXPECT_THROW(fea::utf8_to_codepage(fea::codepage::iso_8859_1, u8"\u20ac"),
+			std::range_error);
+
+	// Every byte of every codepage round trips.
+	std::string all_bytes;
+	for (size_t i = 0; i < 256; ++i) {
+		all_bytes.push_back(char(i));
+	}
+	for (size_t i = 0; i < size_t(fea::codepage::count); ++i) {
+		const fea::codepage page = fea::codepage(i);
+		const std::string utf8 = fea::codepage_to_utf8(page, all_bytes);
+		EXPECT_EQ(fea::code_point_count(utf8), 256u);
+		EXPECT_EQ(fea::utf8_to_codepage(page, utf8), all_bytes);
+		EXPECT_EQ(fea::utf16_to_codepage(
+						  page, fea::codepage_to_utf16(page, all_bytes)),
+				all_bytes);
+	}
+}
+
 TEST(thread, basics) {
 	struct my_obj {
 		size_t data{ 0 };
@@ -299,6 +845,760 @@ TEST(file, basics) {
 		}
 	}
 }
+
+TEST(file, read_text_lines) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		const std::vector<std::string> tester{ "Line1", "Line2", "",
+			"Line4" };
+		const std::vector<std::wstring> wtester{ L"Line1", L"Line2", L"",
+			L"Line4" };
+
+		// Tiny blocks split crlfs and lines.
+		for (size_t chunk_size : { 1, 2, 3, 5, 6, 7, 4096 }) {
+			std::vector<std::string> lines;
+			EXPECT_TRUE(fea::basic_read_text_lines<char>(
+					filepath,
+					[&](std::string_view line) { lines.emplace_back(line); },
+					chunk_size));
+			EXPECT_EQ(lines, tester);
+
+			std::vector<std::wstring> wlines;
+			EXPECT_TRUE(fea::basic_read_text_lines<wchar_t>(
+					filepath,
+					[&](std::wstring_view line) { wlines.emplace_back(line); },
+					chunk_size));
+			EXPECT_EQ(wlines, wtester);
+		}
+
+		{
+			std::vector<std::string> lines;
+			EXPECT_TRUE(fea::read_text_file(filepath,
+					[&](std::string_view line) { lines.emplace_back(line); }));
+			EXPECT_EQ(lines, tester);
+		}
+	}
+
+	EXPECT_FALSE(fea::read_text_file(
+			testfiles_dir / "doesnt_exist.txt", [](std::string_view) {}));
+}
+
+TEST(file, line_table) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		{
+			fea::line_table lines;
+			EXPECT_TRUE(fea::open_text_file(filepath, lines));
+
+			std::vector<std::string_view> tester{ "Line1", "Line2", "",
+				"Line4" };
+			ASSERT_EQ(lines.size(), tester.size());
+			EXPECT_EQ(std::vector<std::string_view>(lines.begin(), lines.end()),
+					tester);
+			EXPECT_EQ(lines.text(), "Line1Line2Line4");
+			EXPECT_EQ(lines.front(), "Line1");
+			EXPECT_EQ(lines.back(), "Line4");
+			EXPECT_EQ(lines.end() - lines.begin(), 4);
+
+			fea::mapped_file file{ filepath };
+			fea::line_table mapped_lines;
+			EXPECT_TRUE(fea::open_text_file(file, mapped_lines));
+			EXPECT_TRUE(std::equal(lines.begin(), lines.end(),
+					mapped_lines.begin(), mapped_lines.end()));
+		}
+
+		{
+			fea::wline_table lines;
+			EXPECT_TRUE(fea::wopen_text_file(filepath, lines));
+
+			std::vector<std::wstring_view> tester{ L"Line1", L"Line2", L"",
+				L"Line4" };
+			ASSERT_EQ(lines.size(), tester.size());
+			for (size_t i = 0; i < lines.size(); ++i) {
+				EXPECT_EQ(lines[i], tester[i]);
+			}
+		}
+	}
+}
+
+TEST(file, parallel_read_text_file) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		const std::vector<std::string> tester{ "Line1", "Line2", "",
+			"Line4" };
+
+		{
+			fea::mtx_safe<std::vector<std::string>> mt_lines;
+			EXPECT_TRUE(fea::parallel_read_text_file(
+					filepath, [&](std::string_view line, size_t) {
+						mt_lines.write([&](std::vector<std::string>& v) {
+							v.emplace_back(line);
+						});
+					}));
+
+			std::vector<std::string> lines = mt_lines.extract();
+			std::sort(lines.begin(), lines.end());
+			std::vector<std::string> sorted_tester = tester;
+			std::sort(sorted_tester.begin(), sorted_tester.end());
+			EXPECT_EQ(lines, sorted_tester);
+		}
+
+		{
+			std::vector<std::vector<std::string>> results;
+			EXPECT_TRUE(fea::parallel_read_text_file(filepath, results,
+					[](std::string_view line, std::vector<std::string>& r) {
+						r.emplace_back(line);
+					}));
+
+			std::vector<std::string> lines;
+			for (const std::vector<std::string>& r : results) {
+				lines.insert(lines.end(), r.begin(), r.end());
+			}
+			EXPECT_EQ(lines, tester);
+		}
+	}
+
+	{
+		// Lines snap to the range they start in.
+		std::string text;
+		std::vector<std::string> tester;
+		for (size_t i = 0; i < 1000; ++i) {
+			tester.push_back(std::to_string(i * 7919));
+			text += tester.back() + (i % 2 == 0 ? "\r\n" : "\n");
+		}
+
+		std::vector<std::vector<std::string>> results(fea::num_threads());
+		fea::parallel_for_line_ranges(
+				text, [&](std::string_view lines, size_t thread_idx) {
+					fea::for_each_line(lines, [&](std::string_view line) {
+						results[thread_idx].emplace_back(line);
+					});
+				});
+
+		std::vector<std::string> lines;
+		for (const std::vector<std::string>& r : results) {
+			lines.insert(lines.end(), r.begin(), r.end());
+		}
+		EXPECT_EQ(lines, tester);
+	}
+
+	{
+		// Exceptions reach the caller instead of terminating.
+		std::string text;
+		for (size_t i = 0; i < 1000; ++i) {
+			text += "line\n";
+		}
+		EXPECT_THROW(fea::parallel_for_line_ranges(text,
+							 [](std::string_view, size_t) {
+								 throw std::runtime_error{ "ranges" };
+							 }),
+				std::runtime_error);
+
+		std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+		for (const std::filesystem::path& filepath :
+				std::filesystem::directory_iterator(testfiles_dir)) {
+			std::vector<size_t> results;
+			EXPECT_THROW(fea::parallel_read_text_file(filepath, results,
+								 [](std::string_view line, size_t&) {
+									 if (line == "Line4") {
+										 throw std::runtime_error{ "line" };
+									 }
+								 }),
+					std::runtime_error);
+		}
+	}
+}
+
+TEST(file, read_file_into) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	fea::file_buffer buffer;
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		std::string tester = "Line1\nLine2\n\nLine4";
+		if (filepath.string().find("crlf") != std::string::npos) {
+			tester = "Line1\r\nLine2\r\n\r\nLine4";
+		}
+
+		EXPECT_TRUE(fea::read_file_into(filepath, buffer));
+		EXPECT_EQ(buffer.size(), tester.size());
+		EXPECT_EQ(buffer.view(), tester);
+
+		// Tiny reads.
+		fea::read_file_options opts;
+		opts.chunk_size = 3;
+		std::string str = "garbage which is longer than the file";
+		EXPECT_TRUE(fea::read_file_into(filepath, str, opts));
+		EXPECT_EQ(str, tester);
+
+		opts.append = true;
+		opts.offset = 5;
+		opts.max_size = 4;
+		EXPECT_TRUE(fea::read_file_into(filepath, str, opts));
+		EXPECT_EQ(str, tester + tester.substr(5, 4));
+
+		opts = {};
+		opts.offset = 1000;
+		std::vector<uint8_t> bytes{ 1, 2, 3 };
+		EXPECT_TRUE(fea::read_file_into(filepath, bytes, opts));
+		EXPECT_TRUE(bytes.empty());
+	}
+
+	size_t capacity = buffer.capacity();
+	buffer.clear();
+	EXPECT_TRUE(buffer.empty());
+	EXPECT_EQ(buffer.capacity(), capacity);
+
+	EXPECT_FALSE(fea::read_file_into(testfiles_dir / "doesnt_exist", buffer));
+}
+
+TEST(file, load_files) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	std::vector<std::filesystem::path> paths;
+	std::vector<std::string> testers;
+	for (size_t i = 0; i < 50; ++i) {
+		for (const std::filesystem::path& filepath :
+				std::filesystem::directory_iterator(testfiles_dir)) {
+			paths.push_back(filepath);
+			testers.emplace_back();
+			fea::open_text_file_raw(filepath, testers.back());
+		}
+	}
+
+	for (size_t max_in_flight : { 0, 1, 4 }) {
+		fea::load_files_options opts;
+		opts.max_in_flight = max_in_flight;
+
+		std::vector<std::string> results(paths.size());
+		EXPECT_TRUE(fea::load_files(
+				paths,
+				[&](size_t idx, const fea::file_buffer& data) {
+					results[idx] = data.view();
+				},
+				opts));
+		EXPECT_EQ(results, testers);
+	}
+
+	paths.push_back(testfiles_dir / "doesnt_exist");
+	std::atomic<size_t> count{ 0 };
+	EXPECT_FALSE(fea::load_files(
+			paths, [&](size_t, const fea::file_buffer&) { ++count; }));
+	EXPECT_EQ(count, paths.size() - 1);
+
+	// Exceptions reach the caller, and stop the other workers.
+	count = 0;
+	EXPECT_THROW(fea::load_files(paths,
+						 [&](size_t, const fea::file_buffer&) {
+							 ++count;
+							 throw std::runtime_error{ "load_files" };
+						 }),
+			std::runtime_error);
+	EXPECT_LE(count, fea::num_threads());
+}
+
+TEST(file, async_read) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		std::vector<uint8_t> tester;
+		ASSERT_TRUE(fea::open_binary_file(filepath, tester));
+
+		const std::vector<std::string> line_tester{ "Line1", "Line2", "",
+			"Line4" };
+
+		for (size_t chunk_size : { 1, 2, 3, 6, 7, 4096 }) {
+			fea::async_read_options opts;
+			opts.chunk_size = chunk_size;
+			opts.buffer_count = 2;
+
+			std::vector<uint8_t> bytes;
+			EXPECT_TRUE(fea::async_read_binary_file(
+					filepath,
+					[&](const uint8_t* data, size_t size) {
+						EXPECT_LE(size, chunk_size);
+						bytes.insert(bytes.end(), data, data + size);
+					},
+					opts));
+			EXPECT_EQ(bytes, tester);
+
+			std::vector<std::string> lines;
+			EXPECT_TRUE(fea::async_read_text_file(
+					filepath,
+					[&](std::string_view line) { lines.emplace_back(line); },
+					opts));
+			EXPECT_EQ(lines, line_tester);
+		}
+
+		// The reader thread is stopped when the consumer throws.
+		fea::async_read_options opts;
+		opts.chunk_size = 1;
+		auto thrower = [](const uint8_t*, size_t) {
+			throw std::runtime_error{ "stop" };
+		};
+		EXPECT_THROW(fea::async_read_binary_file(filepath, thrower, opts),
+				std::runtime_error);
+	}
+
+	EXPECT_FALSE(fea::async_read_binary_file(
+			testfiles_dir / "doesnt_exist", [](const uint8_t*, size_t) {}));
+}
+
+TEST(file, write) {
+	std::filesystem::path out_dir = std::filesystem::temp_directory_path();
+	std::filesystem::path out_path = out_dir / "fea_utils_write_test.txt";
+
+	const std::vector<std::string> lines{ "Line1", "Line2", "", "Line4" };
+	const std::string tester = "Line1\nLine2\n\nLine4\n";
+
+	{
+		EXPECT_TRUE(fea::write_text_file(out_path, lines));
+		std::string text;
+		EXPECT_TRUE(fea::open_text_file_raw(out_path, text));
+		EXPECT_EQ(text, tester);
+	}
+
+	{
+		fea::write_file_options opts;
+		opts.atomic = true;
+		opts.preallocate = 1024 * 1024;
+		EXPECT_TRUE(fea::write_text_file(out_path, "atomic", opts));
+		EXPECT_FALSE(std::filesystem::exists(out_path.string() + ".tmp"));
+
+		std::string text;
+		EXPECT_TRUE(fea::open_text_file_raw(out_path, text));
+		EXPECT_EQ(text, "atomic");
+	}
+
+	{
+		// Temporary files are unique, and leave user files alone.
+		std::filesystem::path user_tmp = out_path;
+		user_tmp += ".tmp";
+		EXPECT_TRUE(fea::write_text_file(user_tmp, "mine"));
+
+		namespace fs = std::filesystem;
+		fs::permissions(out_path, fs::perms::owner_read | fs::perms::owner_write);
+
+		fea::write_file_options opts;
+		opts.atomic = true;
+		fea::file_writer first{ out_path, opts };
+		fea::file_writer second{ out_path, opts };
+		ASSERT_TRUE(first.is_open());
+		ASSERT_TRUE(second.is_open());
+		EXPECT_TRUE(first.write_line("first"));
+		EXPECT_TRUE(second.write_line("second"));
+		EXPECT_TRUE(first.close());
+		EXPECT_TRUE(second.close());
+
+		std::string text;
+		EXPECT_TRUE(fea::open_text_file_raw(out_path, text));
+		EXPECT_EQ(text, "second\n");
+		EXPECT_TRUE(fea::open_text_file_raw(user_tmp, text));
+		EXPECT_EQ(text, "mine");
+
+		// The destination's permissions are kept.
+		EXPECT_EQ(fs::status(out_path).permissions() & fs::perms::all,
+				fs::perms::owner_read | fs::perms::owner_write);
+		fs::permissions(out_path, fs::perms::owner_all | fs::perms::group_read
+						| fs::perms::others_read);
+		fs::remove(user_tmp);
+	}
+
+	{
+		// Writes smaller and bigger than the buffer.
+		fea::write_file_options opts;
+		opts.buffer_size = 7;
+		fea::file_writer writer{ out_path, opts };
+		ASSERT_TRUE(writer.is_open());
+		for (size_t i = 0; i < 100; ++i) {
+			EXPECT_TRUE(writer.write_lines(lines));
+		}
+
+		fea::file_writer moved = std::move(writer);
+		EXPECT_FALSE(writer.is_open());
+		EXPECT_TRUE(moved.write_line("end", "\r\n"));
+		EXPECT_TRUE(moved.close());
+
+		std::string expected;
+		for (size_t i = 0; i < 100; ++i) {
+			expected += tester;
+		}
+		expected += "end\r\n";
+
+		std::string text;
+		EXPECT_TRUE(fea::open_text_file_raw(out_path, text));
+		EXPECT_EQ(text, expected);
+	}
+
+	{
+		std::vector<uint8_t> bytes{ 0, 1, 2, 255 };
+		EXPECT_TRUE(fea::write_binary_file(out_path, bytes));
+
+		fea::write_file_options opts;
+		opts.append = true;
+		EXPECT_TRUE(fea::write_binary_file(out_path, bytes, opts));
+
+		std::vector<uint8_t> read_bytes;
+		EXPECT_TRUE(fea::open_binary_file(out_path, read_bytes));
+		EXPECT_EQ(read_bytes,
+				std::vector<uint8_t>({ 0, 1, 2, 255, 0, 1, 2, 255 }));
+	}
+
+	std::filesystem::remove(out_path);
+	EXPECT_FALSE(fea::write_text_file(out_dir / "doesnt_exist/a.txt", "a"));
+
+	{
+		// Raw wide reads widen every byte, nulls included.
+		EXPECT_TRUE(fea::write_text_file(out_path, std::string{ "a\0\xE9", 3 }));
+		std::wstring text;
+		EXPECT_TRUE(fea::wopen_text_file_raw(out_path, text));
+		EXPECT_EQ(text, (std::wstring{ L'a', L'\0', wchar_t(0xE9) }));
+
+		// Custom stream and string types.
+		std::u16string text16;
+		EXPECT_TRUE((fea::open_text_file_raw<std::wifstream>(out_path, text16)));
+		EXPECT_EQ(text16, (std::u16string{ u'a', u'\0', char16_t(0xE9) }));
+		std::string bytes;
+		EXPECT_TRUE((fea::open_text_file_raw<std::ifstream>(out_path, bytes)));
+		EXPECT_EQ(bytes, (std::string{ "a\0\xE9", 3 }));
+		std::filesystem::remove(out_path);
+		EXPECT_FALSE(fea::wopen_text_file_raw(out_path, text));
+	}
+}
+
+TEST(file, reconstruct_text_file) {
+	// High bytes, surrogate pairs, and a pair straddling load blocks.
+	std::u32string expected = std::u32string(2047, U'a') + U"\U0001F600";
+	expected += std::u32string(100, U'\u00e9') + U"\u6f22\u00ff";
+	const std::u16string utf16 = fea::utf32_to_utf16(expected);
+
+	auto to_bytes = [](const auto& str, bool big_endian) {
+		using char_t = typename std::decay_t<decltype(str)>::value_type;
+		std::string ret;
+		for (char_t c : str) {
+			for (size_t i = 0; i < sizeof(char_t); ++i) {
+				const size_t shift = big_endian ? sizeof(char_t) - 1 - i : i;
+				ret.push_back(char((uint32_t(c) >> (shift * 8)) & 0xFF));
+			}
+		}
+		return ret;
+	};
+
+	std::u32string out;
+	EXPECT_TRUE(fea::reconstruct_text_file(to_bytes(utf16, false),
+			fea::text_encoding::utf16le, out));
+	EXPECT_EQ(out, expected);
+	EXPECT_TRUE(fea::reconstruct_text_file(to_bytes(utf16, true),
+			fea::text_encoding::utf16be, out));
+	EXPECT_EQ(out, expected);
+	EXPECT_TRUE(fea::reconstruct_text_file(to_bytes(expected, false),
+			fea::text_encoding::utf32le, out));
+	EXPECT_EQ(out, expected);
+	EXPECT_TRUE(fea::reconstruct_text_file(to_bytes(expected, true),
+			fea::text_encoding::utf32be, out));
+	EXPECT_EQ(out, expected);
+
+	// Lone surrogates, truncated pairs and odd sizes.
+	EXPECT_FALSE(fea::reconstruct_text_file(
+			to_bytes(utf16.substr(0, 2048), false),
+			fea::text_encoding::utf16le, out));
+	EXPECT_TRUE(out.empty());
+	EXPECT_FALSE(fea::reconstruct_text_file(
+			to_bytes(std::u32string{ U'a', char32_t(0xD800) }, true),
+			fea::text_encoding::utf32be, out));
+	EXPECT_FALSE(fea::reconstruct_text_file(
+			std::string(3, 'a'), fea::text_encoding::utf16le, out));
+
+	char32_t units[5];
+	fea::load_units("\x00\x00\xFE\xFF\x00\x01\xF6\x00\x12\x34\x56\x78"
+					"\x80\x00\x00\x01\xFF\xFF\xFF\xFF",
+			5, true, units);
+	EXPECT_EQ(units[0], char32_t(0xFEFF));
+	EXPECT_EQ(units[1], char32_t(0x1F600));
+	EXPECT_EQ(units[2], char32_t(0x12345678));
+	EXPECT_EQ(units[3], char32_t(0x80000001));
+	EXPECT_EQ(units[4], char32_t(0xFFFFFFFF));
+}
+
+TEST(file, decode_text_file) {
+	const std::filesystem::path fpath
+			= std::filesystem::temp_directory_path() / "fea_decode_test.txt";
+	const std::u32string expected = U"Line1\n\u00e9\u6f22\U0001F600\n";
+	const std::string utf8 = fea::utf32_to_utf8(expected);
+	const std::u16string utf16 = fea::utf32_to_utf16(expected);
+
+	auto test = [&](const std::string& bytes, fea::text_encoding enc,
+						const fea::decode_text_options& opts = {}) {
+		ASSERT_TRUE(fea::write_text_file(fpath, bytes));
+
+		std::u32string out32;
+		EXPECT_EQ(fea::decode_text_file(fpath, out32, opts), enc);
+		EXPECT_EQ(out32, expected);
+
+		std::string out8;
+		EXPECT_EQ(fea::decode_text_file(fpath, out8, opts), enc);
+		EXPECT_EQ(out8, utf8);
+	};
+
+	std::string utf16le;
+	std::string utf16be;
+	for (char16_t c : utf16) {
+		utf16le += { char(c & 0xFF), char(c >> 8) };
+		utf16be += { char(c >> 8), char(c & 0xFF) };
+	}
+	std::string utf32le;
+	for (char32_t c : expected) {
+		utf32le += { char(c & 0xFF), char((c >> 8) & 0xFF),
+			char((c >> 16) & 0xFF), char(c >> 24) };
+	}
+
+	test(utf8, fea::text_encoding::utf8);
+	test("\xEF\xBB\xBF" + utf8, fea::text_encoding::utf8);
+	test("\xFF\xFE" + utf16le, fea::text_encoding::utf16le);
+	test("\xFE\xFF" + utf16be, fea::text_encoding::utf16be);
+	test(std::string{ "\xFF\xFE\x00\x00", 4 } + utf32le,
+			fea::text_encoding::utf32le);
+	test(utf16le, fea::text_encoding::utf16le);
+	test(utf32le, fea::text_encoding::utf32le);
+
+	// Not valid in any encoding.
+	ASSERT_TRUE(fea::write_text_file(fpath, "abc\xFF"));
+	std::u32string out;
+	EXPECT_EQ(fea::decode_text_file(fpath, out), fea::text_encoding::count);
+	EXPECT_TRUE(out.empty());
+
+	std::filesystem::remove(fpath);
+	EXPECT_EQ(fea::decode_text_file(fpath, out), fea::text_encoding::count);
+}
+
+TEST(file, detect_encoding) {
+	using namespace std::string_literals;
+
+	EXPECT_EQ(fea::detect_encoding("Line1\nLine2"), fea::text_encoding::utf8);
+	EXPECT_EQ(fea::detect_encoding(u8"L\u00e9gende \u6f22\U0001F600"),
+			fea::text_encoding::utf8);
+	EXPECT_EQ(fea::detect_encoding(""), fea::text_encoding::utf8);
+
+	// Invalid utf8 : stray continuation, surrogate, truncated.
+	EXPECT_EQ(fea::detect_encoding("Line\x80 1"), fea::text_encoding::count);
+	EXPECT_EQ(fea::detect_encoding("Line\xED\xA0\x80 1"),
+			fea::text_encoding::count);
+	EXPECT_EQ(
+			fea::detect_encoding("Line 1 \xE6\xBC"), fea::text_encoding::count);
+	EXPECT_EQ(fea::detect_encoding("Line 1 \xE6\xBC", 8),
+			fea::text_encoding::utf8);
+
+	const std::string utf16le = "L\0i\0n\0e\0\x41\x26\0"s;
+	const std::string utf16be = "\0L\0i\0n\0e\x26\x41\0\x31"s;
+	EXPECT_EQ(fea::detect_encoding(utf16le), fea::text_encoding::utf16le);
+	EXPECT_EQ(fea::detect_encoding(utf16be), fea::text_encoding::utf16be);
+
+	const std::string utf32le = "L\0\0\0i\0\0\0n\0\0\0e\0\0\0\x00\xF6\x01\0"s;
+	const std::string utf32be = "\0\0\0L\0\0\0i\0\0\0n\0\0\0e\0\x01\xF6\0"s;
+	EXPECT_EQ(fea::detect_encoding(utf32le), fea::text_encoding::utf32le);
+	EXPECT_EQ(fea::detect_encoding(utf32be), fea::text_encoding::utf32be);
+
+	// Only the sample is scanned.
+	std::string big(100000, 'a');
+	big += utf16le;
+	EXPECT_EQ(fea::detect_encoding(big), fea::text_encoding::utf16le);
+	EXPECT_EQ(fea::detect_encoding(big, 4096), fea::text_encoding::utf8);
+}
+
+TEST(file, line_index) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		fea::mapped_file file{ filepath, fea::mapped_file_mode::read_only,
+			fea::mapped_file_hint::random };
+		ASSERT_TRUE(file.is_open());
+
+		fea::line_index index{ file };
+		ASSERT_EQ(index.size(), 4u);
+		EXPECT_EQ(index.line(file, 0), "Line1");
+		EXPECT_EQ(index.line(file, 1), "Line2");
+		EXPECT_EQ(index.line(file, 2), "");
+		EXPECT_EQ(index.line(file, 3), "Line4");
+		EXPECT_EQ(index.lines(file, 2, 2), "");
+
+		std::string tester = "Line2\n\nLine4";
+		if (filepath.string().find("crlf") != std::string::npos) {
+			tester = "Line2\r\n\r\nLine4";
+		}
+		EXPECT_EQ(index.lines(file, 1, 4), tester);
+
+		std::filesystem::path sidecar = std::filesystem::temp_directory_path()
+				/ filepath.filename();
+		sidecar += ".idx";
+		std::filesystem::remove(sidecar);
+
+		fea::line_index written;
+		EXPECT_TRUE(fea::open_line_index(file, sidecar, written));
+		EXPECT_TRUE(std::filesystem::exists(sidecar));
+
+		fea::line_index loaded;
+		EXPECT_TRUE(fea::open_line_index(file, sidecar, loaded));
+		EXPECT_TRUE(loaded.matches(file));
+		EXPECT_EQ(loaded.stamp(), file.stamp());
+		ASSERT_EQ(loaded.size(), index.size());
+		for (size_t i = 0; i < index.size(); ++i) {
+			EXPECT_EQ(loaded.line(file, i), index.line(file, i));
+		}
+
+		EXPECT_FALSE(loaded.matches("Line1\nLine2"));
+		std::filesystem::remove(sidecar);
+	}
+
+	{
+		fea::line_index index{ std::string_view{ "a\n\nb\n" } };
+		EXPECT_EQ(index.size(), 3u);
+		EXPECT_EQ(index.offset(2), 3u);
+		EXPECT_EQ(index.line("a\n\nb\n", 2), "b");
+
+		EXPECT_TRUE(fea::line_index{ std::string_view{} }.empty());
+	}
+
+	{
+		// Rewritten files are reindexed, even when their size and sampled
+		// hash are unchanged.
+		std::string text(20000, 'a');
+		text[5000] = '\n';
+		const std::filesystem::path filepath
+				= std::filesystem::temp_directory_path() / "line_index.txt";
+		std::filesystem::path sidecar = filepath;
+		sidecar += ".idx";
+		ASSERT_TRUE(fea::write_text_file(filepath, text));
+		std::filesystem::remove(sidecar);
+
+		fea::line_index index;
+		{
+			fea::mapped_file file{ filepath };
+			EXPECT_TRUE(fea::open_line_index(file, sidecar, index));
+			EXPECT_EQ(index.size(), 2u);
+		}
+
+		// Atomic writes replace the file, timestamps may be too coarse to
+		// tell writes apart.
+		fea::write_file_options opts;
+		opts.atomic = true;
+		text[5000] = 'a';
+		text[10000] = '\n';
+		ASSERT_TRUE(fea::write_text_file(filepath, text, opts));
+		{
+			fea::mapped_file file{ filepath };
+			EXPECT_TRUE(index.matches(file.view()));
+			EXPECT_FALSE(index.matches(file));
+			EXPECT_TRUE(fea::open_line_index(file, sidecar, index));
+			EXPECT_EQ(index.offset(1), 10001u);
+		}
+
+		// Indexes of strings have no stamp to compare.
+		fea::mapped_file file{ filepath };
+		EXPECT_FALSE(fea::line_index{ file.view() }.matches(file));
+		std::filesystem::remove(filepath);
+		std::filesystem::remove(sidecar);
+	}
+
+	{
+		// Corrupt and truncated sidecars are rejected.
+		const std::string_view text = "a\nb\nc";
+		std::filesystem::path sidecar
+				= std::filesystem::temp_directory_path() / "corrupt.idx";
+		ASSERT_TRUE(fea::line_index{ text }.save(sidecar));
+
+		fea::line_index loaded;
+		EXPECT_TRUE(loaded.load(sidecar));
+		EXPECT_EQ(loaded.size(), 3u);
+
+		{
+			// Header : magic, version, size, hash, stamp, count and wide flag.
+			std::fstream fs{ sidecar,
+				std::ios::binary | std::ios::in | std::ios::out };
+			fs.seekp(4 + 4 + 8 + 8 + 32 + 8 + 1 + 4);
+			const uint32_t bad = 1000;
+			fs.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+		}
+		EXPECT_FALSE(loaded.load(sidecar));
+		EXPECT_TRUE(loaded.empty());
+
+		ASSERT_TRUE(fea::line_index{ text }.save(sidecar));
+		std::filesystem::resize_file(sidecar, 36);
+		EXPECT_FALSE(loaded.load(sidecar));
+
+		{
+			// A huge size and count must not be allocated.
+			ASSERT_TRUE(fea::line_index{ text }.save(sidecar));
+			std::fstream fs{ sidecar,
+				std::ios::binary | std::ios::in | std::ios::out };
+			const uint64_t huge = uint64_t(1) << 60;
+			fs.seekp(4 + 4);
+			fs.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+			fs.seekp(4 + 4 + 8 + 8 + 32);
+			fs.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+		}
+		EXPECT_FALSE(loaded.load(sidecar));
+		EXPECT_TRUE(loaded.empty());
+		std::filesystem::remove(sidecar);
+	}
+}
+
+TEST(file, mapped_file) {
+	std::filesystem::path testfiles_dir = exe_path / "tests_data/";
+	for (const std::filesystem::path& filepath :
+			std::filesystem::directory_iterator(testfiles_dir)) {
+		fea::mapped_file file{ filepath, fea::mapped_file_mode::read_only,
+			fea::mapped_file_hint::sequential };
+		ASSERT_TRUE(file.is_open());
+
+		std::string tester = "Line1\nLine2\n\nLine4";
+		if (filepath.string().find("crlf") != std::string::npos) {
+			tester = "Line1\r\nLine2\r\n\r\nLine4";
+		}
+
+		{
+			std::string_view text;
+			EXPECT_TRUE(fea::open_text_file_raw(file, text));
+			EXPECT_EQ(text, tester);
+			EXPECT_EQ(text.data(), reinterpret_cast<const char*>(file.data()));
+		}
+
+		{
+			std::vector<std::string_view> lines;
+			EXPECT_TRUE(fea::open_text_file(file, lines));
+
+			std::vector<std::string_view> line_tester{ "Line1", "Line2", "",
+				"Line4" };
+			EXPECT_EQ(lines, line_tester);
+		}
+
+		{
+			fea::mapped_file moved = std::move(file);
+			EXPECT_FALSE(file.is_open());
+			EXPECT_TRUE(moved.is_open());
+			EXPECT_EQ(moved.view(), tester);
+		}
+	}
+
+	{
+		// Writes are private.
+		std::filesystem::path filepath = testfiles_dir / "text_file_lf.txt";
+		fea::mapped_file file{ filepath,
+			fea::mapped_file_mode::copy_on_write };
+		ASSERT_TRUE(file.is_open());
+		file.data()[0] = 'X';
+		EXPECT_EQ(file.view().substr(0, 5), "Xine1");
+
+		fea::mapped_file reopened{ filepath };
+		EXPECT_EQ(reopened.view().substr(0, 5), "Line1");
+	}
+
+	{
+		fea::mapped_file file;
+		EXPECT_FALSE(file.is_open());
+		EXPECT_FALSE(fea::read_text_file(file, [](std::string_view) {}));
+	}
+}
 } // namespace
 
 int main(int argc, char** argv) {